@@ -0,0 +1,25 @@
+# Writes a C++ header embedding text files as null-terminated arrays, so that the executable
+# carries its OpenCL source and runs from any directory.
+#
+# Usage: embed_sources.ps1 <header> <name>=<file> [<name>=<file> ...]
+param(
+	[Parameter(Mandatory = $true)][string]$Header,
+	[Parameter(ValueFromRemainingArguments = $true)][string[]]$Sources
+)
+
+$lines = @("// Generated by embed_sources.ps1 at build time, do not edit.", "#pragma once", "")
+foreach ($source in $Sources) {
+	$name, $file = $source -split '=', 2
+	# byte arrays rather than string literals, which MSVC limits to 16 KB each.
+	$bytes = [System.IO.File]::ReadAllBytes($file) + [byte]0
+
+	$lines += "static const unsigned char $name[] = {"
+	for ($i = 0; $i -lt $bytes.Length; $i += 16) {
+		$last = [Math]::Min($i + 15, $bytes.Length - 1)
+		$lines += "`t" + (($bytes[$i..$last] | ForEach-Object { '0x{0:x2}' -f $_ }) -join ', ') + ","
+	}
+	$lines += "};"
+	$lines += ""
+}
+
+Set-Content -Path $Header -Value $lines -Encoding Ascii
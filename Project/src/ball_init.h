@@ -0,0 +1,160 @@
+/*
+	Initial state of the balls, shared by the host and the kernels like ball_layout.h: the
+	host hands this file to the CL compiler after ball_layout.h, and the CPU backend and the
+	init_balls kernel both make their balls with make_ball(), so that a seed gives the same
+	scene on either.
+
+	Every ball draws its numbers from Philox4x32-10 (Salmon et al., "Parallel random numbers:
+	as easy as 1, 2, 3", 2011), a counter-based generator: the numbers of ball i are a pure
+	function of the seed and i, so the balls are made in any order, by any number of threads
+	or work-items, with no generator state to share.
+
+	make_ball() places the balls anywhere, overlapping or not. The lattice placement then moves
+	every ball to its square with lattice_center(), from its rank among the balls of its radius
+	class and the layout of the bands, which only depends on how many balls each class has (see
+	place_on_lattice()). The jitter of ball i comes from its third counter, (i, 2).
+
+	Written in the common subset of C++ and OpenCL C, with only the operations OpenCL rounds
+	as the host does (+, -, *, conversions), and with contraction into fused multiply-adds
+	off on both sides. MIN_RADIUS comes from the host's defines, or from the build options on
+	the device (see program_options()).
+	The project builds with /fp:precise, and the pragmas below keep it so for the functions
+	here under any other flags; toolchains not listed there need -ffp-contract=off.
+*/
+#ifndef BALL_INIT_H
+#define BALL_INIT_H
+
+#ifdef __OPENCL_VERSION__
+// a * b + c must round twice as on the host, not once as a fused multiply-add.
+#pragma OPENCL FP_CONTRACT OFF
+#define BALL_INIT_FUNC
+#define MUL_HI(a, b) mul_hi(a, b)
+#define BALL_INIT_U64 unsigned long
+#else
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(_MSC_VER)
+// MSVC has no way back to the previous state, so contraction stays off for the file.
+#pragma fp_contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+#define BALL_INIT_FUNC static inline
+#define MUL_HI(a, b) (unsigned int)(((unsigned long long)(a) * (b)) >> 32)
+#define BALL_INIT_U64 unsigned long long
+#endif
+
+// radii of 1 to RADIUS_CLASSES * MIN_RADIUS.
+#define RADIUS_CLASSES 3
+
+// inverse mass of the balls of radius radius_class * MIN_RADIUS, of mass 100 * radius. A
+// constant expression: OpenCL need not round a division at run time as the host does.
+#define BALL_INV_MASS(radius_class) (1.f / (int)(MIN_RADIUS * (radius_class) * 100.f))
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+/*
+	Replaces counter with its 4 random words under key.
+*/
+BALL_INIT_FUNC void philox4x32(unsigned int counter[4], unsigned int key_lo, unsigned int key_hi) {
+	for (int round = 0; round < PHILOX_ROUNDS; ++round) {
+		unsigned int hi0 = MUL_HI(PHILOX_M0, counter[0]);
+		unsigned int lo0 = PHILOX_M0 * counter[0];
+		unsigned int hi1 = MUL_HI(PHILOX_M1, counter[2]);
+		unsigned int lo1 = PHILOX_M1 * counter[2];
+
+		counter[0] = hi1 ^ counter[1] ^ key_lo;
+		counter[1] = lo1;
+		counter[2] = hi0 ^ counter[3] ^ key_hi;
+		counter[3] = lo0;
+
+		key_lo += PHILOX_W0;
+		key_hi += PHILOX_W1;
+	}
+}
+
+/*
+	Uniform float in [low, high) from the top 24 bits of word, exact up to the final scaling.
+*/
+BALL_INIT_FUNC float uniform_float(unsigned int word, float low, float high) {
+	float unit = (float)(word >> 8) * (1.f / 16777216.f);
+	return low + (high - low) * unit;
+}
+
+/*
+	Makes ball id of the scene of seed (seed_lo, seed_hi): a radius of 1 to 3 MIN_RADIUS, a
+	mass growing with it, a center anywhere in the box that keeps the ball inside the walls,
+	and a velocity in [-1, 1)^2.
+*/
+BALL_INIT_FUNC void make_ball(unsigned int seed_lo, unsigned int seed_hi, unsigned int id,
+	float center[2], float velocity[2], float* radius, float* inv_mass) {
+	unsigned int words[4] = { id, 0u, 0u, 0u };
+	philox4x32(words, seed_lo, seed_hi);
+
+	unsigned int radius_class = 1u + MUL_HI(words[0], RADIUS_CLASSES);
+	*radius = MIN_RADIUS * (float)radius_class;
+	*inv_mass = radius_class == 1u ? BALL_INV_MASS(1) : radius_class == 2u ? BALL_INV_MASS(2) : BALL_INV_MASS(3);
+	center[0] = uniform_float(words[1], *radius - 1.f, 1.f - *radius);
+	center[1] = uniform_float(words[2], *radius - 1.f, 1.f - *radius);
+	velocity[0] = uniform_float(words[3], -1.f, 1.f);
+
+	// a ball takes 5 numbers, the 5th comes from the next counter.
+	unsigned int more[4] = { id, 1u, 0u, 0u };
+	philox4x32(more, seed_lo, seed_hi);
+	velocity[1] = uniform_float(more[0], -1.f, 1.f);
+}
+
+/*
+	Jittered lattice with a band of rows per radius class, laid out by the host from the number
+	of balls of every class (see lay_out_lattice()). The sizes are given rather than divided
+	out on the device, where a float division need not round as on the host.
+*/
+typedef struct {
+	// squares per row, squares of the band and balls of the class.
+	unsigned int per_row[RADIUS_CLASSES], squares[RADIUS_CLASSES], counts[RADIUS_CLASSES];
+	// size of a square, bottom of the band, and how far a ball moves off the middle of its square.
+	float width[RADIUS_CLASSES], row_height[RADIUS_CLASSES], bottom[RADIUS_CLASSES];
+	float jitter_x[RADIUS_CLASSES], jitter_y[RADIUS_CLASSES];
+} lattice_layout;
+
+/*
+	Radius class, from 0, of a ball of radius radius.
+*/
+BALL_INIT_FUNC unsigned int lattice_class(float radius) {
+	return (unsigned int)(radius * (1.f / MIN_RADIUS) + 0.5f) - 1u;
+}
+
+/*
+	Center of ball id of the scene of seed (seed_lo, seed_hi) on the lattice, the ball of rank
+	rank among the balls of class radius_class: the balls of a class spread evenly over the
+	squares of its band in rank order, and every ball moves at random within its own square.
+*/
+BALL_INIT_FUNC void lattice_center(unsigned int seed_lo, unsigned int seed_hi, unsigned int id,
+	unsigned int radius_class, unsigned int rank, const lattice_layout* layout, float center[2]) {
+	unsigned int c = radius_class;
+	unsigned int square = (unsigned int)((BALL_INIT_U64)rank * layout->squares[c] / layout->counts[c]);
+
+	// the ball's third counter, the first two made it.
+	unsigned int words[4] = { id, 2u, 0u, 0u };
+	philox4x32(words, seed_lo, seed_hi);
+	center[0] = -1.f + ((float)(square % layout->per_row[c]) + 0.5f) * layout->width[c]
+		+ uniform_float(words[0], -layout->jitter_x[c], layout->jitter_x[c]);
+	center[1] = layout->bottom[c] + ((float)(square / layout->per_row[c]) + 0.5f) * layout->row_height[c]
+		+ uniform_float(words[1], -layout->jitter_y[c], layout->jitter_y[c]);
+}
+
+// back to the default for the code that follows.
+#ifdef __OPENCL_VERSION__
+#pragma OPENCL FP_CONTRACT ON
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+/*
+	Layout of the simulation state, shared by the host and the kernels: the host hands this
+	file to the CL compiler ahead of bouncing_balls.cl.
+
+	The balls are stored as a structure of arrays, one device buffer per field, so that
+	neighbouring work-items reading the same field of neighbouring balls read neighbouring
+	memory, and kernels only fetch the fields they use. Render-only data (the colours)
+	stays on the host.
+*/
+#ifndef BALL_LAYOUT_H
+#define BALL_LAYOUT_H
+
+// X(type, name) for every field of the balls, in kernel argument order.
+#define BALL_FIELDS(X) \
+	X(float2, center) \
+	X(float2, velocity) \
+	X(float, radius) \
+	X(float, inv_mass)
+
+#ifdef __OPENCL_VERSION__
+
+// leading parameters of every kernel working on the balls (d_center, d_velocity, ...).
+#define BALL_PARAM(type, name) __global type* d_##name,
+#define BALL_PARAMS BALL_FIELDS(BALL_PARAM)
+
+// passes the fields on to a helper taking BALL_PARAMS.
+#define BALL_ARG(type, name) d_##name,
+#define BALL_ARGS BALL_FIELDS(BALL_ARG)
+
+#else
+
+// number of kernel arguments taken by the fields, the kernel's own arguments come after them.
+#define BALL_ARG_COUNT(type, name) + 1
+const cl_uint BALL_ARGS_COUNT = 0 BALL_FIELDS(BALL_ARG_COUNT);
+
+#endif
+
+#endif
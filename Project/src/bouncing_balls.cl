@@ -1,122 +1,1032 @@
-#define NUM_POINTS 360
-#define PI 3.141592f
+#define SCAN_BLOCK_SIZE 64
+#define RADIX_BITS 4
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_BLOCK_SIZE 64
+#define BVH_STACK_SIZE 64
+#define MAX_NEIGHBOURS 64
+#define MAX_CONTACTS_PER_BALL 16
+#define NO_COLOUR 0xffffffff
 
-constant float DEGREE_TO_RAD = PI / 180;
-constant int NUM_FLOATS = NUM_POINTS * 2;
+// solver stages of a contact within a frame.
+#define SOLVE_FIRST 0
+#define SOLVE_ITERATION 1
+#define SOLVE_RESTITUTION 2
 
-struct ball {
-	float color[3];
-	float center[2];
-	float velocity[2];
-	float radius;
-	int mass;
-};
+// d_flags slots, read back by the host.
+#define FLAG_REBUILD 0
+#define FLAG_LIST_OVERFLOW 1
+#define FLAG_CONTACT_OVERFLOW 2
+#define FLAG_UNRESOLVED 3
+#define FLAG_STACK_OVERFLOW 4
+#define FLAG_COLOURS 5
+
+// defined by the host in the build options (see program_options()), so that every configuration
+// gets its own program with these folded in:
+// NUM_POINTS, the vertices of a tessellated ball,
+// GRAVITY, the vertical acceleration of every ball,
+// RESTITUTION and RESTING_SPEED, how solved contacts bounce (see contact_bias()),
+// MIN_RADIUS, the radius of the smallest balls (see make_ball()).
+
+/*
+	Makes ball id of the scene of seed (seed_lo, seed_hi) in place, the same ball as the
+	host's make_ball() for that seed (see ball_init.h).
+*/
+__kernel void init_balls(BALL_PARAMS unsigned int seed_lo, unsigned int seed_hi, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		float center[2], velocity[2], radius, inv_mass;
+		make_ball(seed_lo, seed_hi, id, center, velocity, &radius, &inv_mass);
+
+		d_center[id] = (float2)(center[0], center[1]);
+		d_velocity[id] = (float2)(velocity[0], velocity[1]);
+		d_radius[id] = radius;
+		d_inv_mass[id] = inv_mass;
+	}
+}
+
+/*
+	Lattice placement, pass 1: flags every ball in the slots of its radius class, class-major
+	(d_lattice_slots[c * balls_count + id] is 1 if ball id is of class c), so that their
+	exclusive scan gives every ball its rank in its class.
+*/
+__kernel void lattice_classes(BALL_PARAMS __global unsigned int* d_lattice_slots, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int radius_class = lattice_class(d_radius[id]);
+		for (unsigned int c = 0; c < RADIUS_CLASSES; ++c) {
+			d_lattice_slots[c * balls_count + id] = c == radius_class;
+		}
+	}
+}
+
+/*
+	Lattice placement, pass 2: moves every ball to its square (see lattice_center()). Its rank
+	is its scanned slot less the first slot of its class.
+*/
+__kernel void lattice_place(BALL_PARAMS __global const unsigned int* d_lattice_slots, lattice_layout layout,
+	unsigned int seed_lo, unsigned int seed_hi, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int radius_class = lattice_class(d_radius[id]);
+		unsigned int first = radius_class * balls_count;
+		float center[2];
+		lattice_center(seed_lo, seed_hi, id, radius_class, d_lattice_slots[first + id] - d_lattice_slots[first], &layout, center);
+		d_center[id] = (float2)(center[0], center[1]);
+	}
+}
 
 /*
 	Handles the ball-wall computation.
 */
-__kernel void wall_bounce(__global struct ball* d_balls, float delta_t, unsigned int balls_count) {
+__kernel void wall_bounce(BALL_PARAMS float delta_t, unsigned int balls_count) {
 	 int id = get_global_id(0);
 		if (id < balls_count) {
-			__global struct ball* current = &d_balls[id];
+			float2 center = d_center[id];
+			float2 velocity = d_velocity[id];
+			float radius = d_radius[id];
 
-			current->velocity[1] += delta_t * -1.5f;
-			current->center[0] += delta_t * current->velocity[0];
-			current->center[1] += delta_t * current->velocity[1];
+			velocity.y += delta_t * GRAVITY;
+			center += delta_t * velocity;
 
-			float t_wall = 1.f - current->radius;
-			float b_wall = current->radius - 1.f;
+			float t_wall = 1.f - radius;
+			float b_wall = radius - 1.f;
 			float r_wall = t_wall;
 			float l_wall = b_wall;
 
-			if (current->center[0] > r_wall) {
-				current->center[0] = r_wall;
-				current->velocity[0] *= -1.f;
+			if (center.x > r_wall) {
+				center.x = r_wall;
+				velocity.x *= -1.f;
 			}
-			else if (current->center[0] < l_wall) {
-				current->center[0] = l_wall;
-				current->velocity[0] *= -1.f;
+			else if (center.x < l_wall) {
+				center.x = l_wall;
+				velocity.x *= -1.f;
 			}
 
-			if (current->center[1] > t_wall) {
-				current->center[1] = t_wall;
-				current->velocity[1] *= -1.f;
+			if (center.y > t_wall) {
+				center.y = t_wall;
+				velocity.y *= -1.f;
 			}
-			else if (current->center[1] < b_wall) {
-				current->center[1] = b_wall;
-				current->velocity[1] *= -1.f;
+			else if (center.y < b_wall) {
+				center.y = b_wall;
+				velocity.y *= -1.f;
 			}
+
+			d_center[id] = center;
+			d_velocity[id] = velocity;
 		}
 }
 
 /*
-	Handles the ball-ball computation.
+	Resolves the collision between two balls, if any.
+
+	Shared by every broad-phase: they only differ in how they find the candidate pairs.
 */
-__kernel void ball_bounce(__global unsigned int* d_pairs, __global struct ball* d_balls, unsigned int pairs_count) {
-	unsigned int id = get_global_id(0);
+void collide(BALL_PARAMS unsigned int id, unsigned int other_id) {
+	float2 center = d_center[id];
+	float2 other_center = d_center[other_id];
+	float min_dist = d_radius[id] + d_radius[other_id];
+
+	// check for aabb overlap
+	// if true, balls are close enough, computation is worth it.
+	if (center.x + min_dist > other_center.x
+		&& center.y + min_dist > other_center.y
+		&& other_center.x + min_dist > center.x
+		&& other_center.y + min_dist > center.y) {
+
+		float2 c = center - other_center;
+		float mag = dot(c, c);
+
+		// balls are close enough, but it does not mean they have collided.
+		// check for ball collision.
+		// if true, collision occured, handle it
+		if (mag <= min_dist * min_dist) {
+			float dist = sqrt(mag);
+			float overlap = 0.5f * (dist - min_dist);
+			float2 dir = c / dist;
+
+			d_center[id] = center - overlap * dir;
+			d_center[other_id] = other_center + overlap * dir;
+
+			// the lighter ball takes the larger share of the exchange.
+			float2 velocity = d_velocity[id];
+			float2 other_velocity = d_velocity[other_id];
+			float inv_mass = d_inv_mass[id];
+			float other_inv_mass = d_inv_mass[other_id];
+			float ratio = 2.f * dot(velocity - other_velocity, c) / ((inv_mass + other_inv_mass) * mag);
+
+			d_velocity[id] = velocity - inv_mass * ratio * c;
+			d_velocity[other_id] = other_velocity + other_inv_mass * ratio * c;
+		}
+	}
+}
+
+/*
+	Handles a candidate pair found by a spatial broad-phase.
+
+	Without neighbour lists (d_neighbours is null), the pair goes straight to the narrow-phase.
+	Otherwise, other_id is added to the list of ball id if the two balls are within skin of
+	touching. neighbours_count keeps counting past MAX_NEIGHBOURS so overflows can be detected.
+*/
+void handle_pair(BALL_PARAMS unsigned int id, unsigned int other_id, float skin,
+	__global unsigned int* d_neighbours, unsigned int* neighbours_count) {
+	if (!d_neighbours) {
+		collide(BALL_ARGS id, other_id);
+		return;
+	}
+
+	float2 c = d_center[id] - d_center[other_id];
+	float reach = d_radius[id] + d_radius[other_id] + skin;
+
+	if (dot(c, c) <= reach * reach) {
+		if (*neighbours_count < MAX_NEIGHBOURS) d_neighbours[id * MAX_NEIGHBOURS + *neighbours_count] = other_id;
+		++*neighbours_count;
+	}
+}
+
+/*
+	Handles the ball-ball computation (brute force, one work-item per unique pair).
+
+	Work-item k handles the k-th pair (i, j), j < i, of the lower triangle: row i starts
+	at the triangular number i * (i - 1) / 2, so i is recovered by inverting it. The float
+	estimate can be off by one for large ids, hence the integer correction.
+*/
+__kernel void ball_bounce(BALL_PARAMS unsigned int balls_count) {
+	ulong id = get_global_id(0);
+	ulong pairs_count = (ulong)balls_count * (balls_count - 1) / 2;
 	if (id < pairs_count) {
-		unsigned int stride = 2 * id;
-		__global struct ball* current = &d_balls[d_pairs[stride]];
-		__global struct ball* other = &d_balls[d_pairs[stride + 1]];
-
-		float min_dist = current->radius + other->radius;
-
-		// check for aabb overlap
-		// if true, balls are close enough, computation is worth it.
-		if (current->center[0] + min_dist > other->center[0]
-			&& current->center[1] + min_dist > other->center[1]
-			&& other->center[0] + min_dist > current->center[0]
-			&& other->center[1] + min_dist > current->center[1]) {
-
-			float c_x = current->center[0] - other->center[0];
-			float c_y = current->center[1] - other->center[1];
-			float c = pow(c_x, 2.f) + pow(c_y, 2.f);
-
-			// balls are close enough, but it does not mean they have collided.
-			// check for ball collision.
-			// if true, collision occured, handle it
-			if (c <= pow(min_dist, 2.f)) {
-				float dist = sqrt(c);
-				float overlap = 0.5f * (dist - current->radius - other->radius);
-
-				float dir_x = c_x / dist;
-				float dir_y = c_y / dist;
-
-				current->center[0] -= overlap * dir_x;
-				current->center[1] -= overlap * dir_y;
-				other->center[0] += overlap * dir_x;
-				other->center[1] += overlap * dir_y;
-
-				float v_x = current->velocity[0] - other->velocity[0];
-				float v_y = current->velocity[1] - other->velocity[1];
-				int m = current->mass + other->mass;
-				float mag = pow(dist, 2.f);
-				float dot_vc = v_x * c_x + v_y * c_y;
-				float ratio = 2.f * dot_vc / (m * mag);
-
-				current->velocity[0] -= (other->mass * ratio * c_x);
-				current->velocity[1] -= (other->mass * ratio * c_y);
-				other->velocity[0] += (current->mass * ratio * c_x);
-				other->velocity[1] += (current->mass * ratio * c_y);
+		ulong i = (ulong)((1.f + sqrt(1.f + 8.f * id)) / 2.f);
+		while (i * (i - 1) / 2 > id) --i;
+		while ((i + 1) * i / 2 <= id) ++i;
+		ulong j = id - i * (i - 1) / 2;
+
+		collide(BALL_ARGS (unsigned int)i, (unsigned int)j);
+	}
+}
+
+/*
+	Exclusive prefix sum, first pass.
+
+	Each work-item scans SCAN_BLOCK_SIZE consecutive values in place and writes
+	the block total to block_sums. The host scans block_sums the same way until a
+	single block is left, then adds the scanned totals back down with scan_add.
+*/
+__kernel void scan_blocks(__global unsigned int* data, __global unsigned int* block_sums, unsigned int count) {
+	unsigned int id = get_global_id(0);
+	unsigned int begin = id * SCAN_BLOCK_SIZE;
+	if (begin < count) {
+		unsigned int end = min(begin + SCAN_BLOCK_SIZE, count);
+		unsigned int sum = 0;
+
+		for (unsigned int i = begin; i < end; ++i) {
+			unsigned int value = data[i];
+			data[i] = sum;
+			sum += value;
+		}
+		block_sums[id] = sum;
+	}
+}
+
+/*
+	Exclusive prefix sum, second pass: offsets every value by the scanned total of its block.
+*/
+__kernel void scan_add(__global unsigned int* data, __global const unsigned int* block_sums, unsigned int count) {
+	unsigned int id = get_global_id(0);
+	if (id < count) {
+		data[id] += block_sums[id / SCAN_BLOCK_SIZE];
+	}
+}
+
+/*
+	Returns the uniform grid cell containing position (x, y).
+*/
+unsigned int grid_cell(float x, float y, float cell_size, unsigned int grid_dim) {
+	int last = grid_dim - 1;
+	int cell_x = clamp((int)((x + 1.f) / cell_size), 0, last);
+	int cell_y = clamp((int)((y + 1.f) / cell_size), 0, last);
+	return cell_y * grid_dim + cell_x;
+}
+
+/*
+	Uniform grid, pass 1: hashes every ball center into its cell and counts the balls per cell.
+
+	d_cell_counts must be zeroed beforehand.
+*/
+__kernel void grid_count(BALL_PARAMS __global unsigned int* d_cell_ids, __global unsigned int* d_cell_counts,
+	float cell_size, unsigned int grid_dim, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		float2 center = d_center[id];
+
+		unsigned int cell = grid_cell(center.x, center.y, cell_size, grid_dim);
+		d_cell_ids[id] = cell;
+		atomic_inc(&d_cell_counts[cell]);
+	}
+}
+
+/*
+	Uniform grid, pass 2 (counting sort): writes every ball index into its cell's range of d_sorted.
+
+	d_cell_ends starts as a copy of the scanned cell counts (the cell starts) and is used
+	as the insertion cursor, so it holds the end of every cell's range once the pass is done.
+*/
+__kernel void grid_scatter(__global const unsigned int* d_cell_ids, __global unsigned int* d_cell_ends, __global unsigned int* d_sorted,
+	unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int slot = atomic_inc(&d_cell_ends[d_cell_ids[id]]);
+		d_sorted[slot] = id;
+	}
+}
+
+/*
+	Uniform grid, pass 3: narrow-phase of every ball against the balls of its 3x3 neighbouring cells.
+
+	Work-items follow the sorted order so that neighbouring work-items read the same cells.
+	Each pair is handled once, by its lowest ball index. With neighbour lists, the cells are
+	widened by skin and the pairs are recorded instead (see handle_pair()).
+*/
+__kernel void grid_collide(BALL_PARAMS __global const unsigned int* d_sorted, __global const unsigned int* d_cell_ids,
+	__global const unsigned int* d_cell_starts, __global const unsigned int* d_cell_ends, unsigned int grid_dim, float skin,
+	__global unsigned int* d_neighbours, __global unsigned int* d_neighbour_counts, unsigned int balls_count) {
+	unsigned int slot = get_global_id(0);
+	if (slot < balls_count) {
+		unsigned int id = d_sorted[slot];
+		unsigned int neighbours_count = 0;
+
+		int cell = d_cell_ids[id];
+		int cell_x = cell % grid_dim;
+		int cell_y = cell / grid_dim;
+		int last = grid_dim - 1;
+
+		for (int y = max(cell_y - 1, 0); y <= min(cell_y + 1, last); ++y) {
+			for (int x = max(cell_x - 1, 0); x <= min(cell_x + 1, last); ++x) {
+				unsigned int neighbour = y * grid_dim + x;
+
+				for (unsigned int i = d_cell_starts[neighbour]; i < d_cell_ends[neighbour]; ++i) {
+					unsigned int other_id = d_sorted[i];
+					if (other_id > id) {
+						handle_pair(BALL_ARGS id, other_id, skin, d_neighbours, &neighbours_count);
+					}
+				}
 			}
 		}
+
+		if (d_neighbours) d_neighbour_counts[id] = neighbours_count;
+	}
+}
+
+/*
+	Maps a float to an unsigned int with the same ordering, so floats can be radix sorted.
+
+	Positive floats get their sign bit set, negative floats get all their bits flipped.
+*/
+unsigned int float_to_key(float value) {
+	unsigned int bits = as_uint(value);
+	return bits ^ ((bits >> 31) ? 0xffffffff : 0x80000000);
+}
+
+/*
+	Inverse of float_to_key.
+*/
+float key_to_float(unsigned int key) {
+	return as_float(key ^ ((key >> 31) ? 0x80000000 : 0xffffffff));
+}
+
+/*
+	Radix sort, pass 1: counts the digits of every block of RADIX_BLOCK_SIZE keys.
+
+	Counts are stored digit-major (all the blocks of digit 0, then of digit 1, ...) so that
+	their exclusive prefix sum directly gives where each block writes each digit.
+*/
+__kernel void radix_count(__global const unsigned int* keys, __global unsigned int* d_radix_counts, unsigned int shift, unsigned int count) {
+	unsigned int id = get_global_id(0);
+	unsigned int blocks_count = (count + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE;
+	if (id < blocks_count) {
+		unsigned int counts[RADIX_SIZE];
+		for (int d = 0; d < RADIX_SIZE; ++d) counts[d] = 0;
+
+		unsigned int end = min((id + 1) * RADIX_BLOCK_SIZE, count);
+		for (unsigned int i = id * RADIX_BLOCK_SIZE; i < end; ++i) {
+			++counts[(keys[i] >> shift) & (RADIX_SIZE - 1)];
+		}
+
+		for (int d = 0; d < RADIX_SIZE; ++d) d_radix_counts[d * blocks_count + id] = counts[d];
+	}
+}
+
+/*
+	Radix sort, pass 2: moves every key/value pair of a block to its place for the current digit.
+
+	Blocks are walked in order, which keeps the sort stable from one digit to the next.
+*/
+__kernel void radix_scatter(__global const unsigned int* keys_in, __global const unsigned int* values_in,
+	__global unsigned int* keys_out, __global unsigned int* values_out, __global const unsigned int* d_radix_counts,
+	unsigned int shift, unsigned int count) {
+	unsigned int id = get_global_id(0);
+	unsigned int blocks_count = (count + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE;
+	if (id < blocks_count) {
+		unsigned int offsets[RADIX_SIZE];
+		for (int d = 0; d < RADIX_SIZE; ++d) offsets[d] = d_radix_counts[d * blocks_count + id];
+
+		unsigned int end = min((id + 1) * RADIX_BLOCK_SIZE, count);
+		for (unsigned int i = id * RADIX_BLOCK_SIZE; i < end; ++i) {
+			unsigned int key = keys_in[i];
+			unsigned int slot = offsets[(key >> shift) & (RADIX_SIZE - 1)]++;
+			keys_out[slot] = key;
+			values_out[slot] = values_in[i];
+		}
+	}
+}
+
+/*
+	Sort and sweep, pass 1: keys every ball by the left edge of its bounding box, widened by
+	half the skin when building neighbour lists.
+*/
+__kernel void sap_keys(BALL_PARAMS __global unsigned int* d_sort_keys, __global unsigned int* d_sort_values,
+	float skin, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		d_sort_keys[id] = float_to_key(d_center[id].x - d_radius[id] - 0.5f * skin);
+		d_sort_values[id] = id;
+	}
+}
+
+/*
+	Sort and sweep, pass 2: every ball sweeps forward through the balls sorted after it
+	until their left edge passes its right edge, and hands the ones it meets to the narrow-phase.
+*/
+__kernel void sap_sweep(BALL_PARAMS __global const unsigned int* d_sort_keys, __global const unsigned int* d_sort_values,
+	float skin, __global unsigned int* d_neighbours, __global unsigned int* d_neighbour_counts, unsigned int balls_count) {
+	unsigned int slot = get_global_id(0);
+	if (slot < balls_count) {
+		unsigned int id = d_sort_values[slot];
+		unsigned int neighbours_count = 0;
+		// measured from the sorted left edge, as the center may have moved since the sort.
+		unsigned int right_edge = float_to_key(key_to_float(d_sort_keys[slot]) + 2.f * d_radius[id] + skin);
+
+		for (unsigned int i = slot + 1; i < balls_count && d_sort_keys[i] <= right_edge; ++i) {
+			handle_pair(BALL_ARGS id, d_sort_values[i], skin, d_neighbours, &neighbours_count);
+		}
+
+		if (d_neighbours) d_neighbour_counts[id] = neighbours_count;
+	}
+}
+
+/*
+	Spreads the low 15 bits of value out to the even bits.
+*/
+unsigned int expand_bits(unsigned int value) {
+	value &= 0x7fff;
+	value = (value | (value << 8)) & 0x00ff00ff;
+	value = (value | (value << 4)) & 0x0f0f0f0f;
+	value = (value | (value << 2)) & 0x33333333;
+	value = (value | (value << 1)) & 0x55555555;
+	return value;
+}
+
+/*
+	Linear BVH, pass 1: computes the 30-bit Morton code of every ball center in [-1, 1]^2.
+*/
+__kernel void lbvh_morton(BALL_PARAMS __global unsigned int* d_sort_keys, __global unsigned int* d_sort_values,
+	unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		float2 center = d_center[id];
+
+		unsigned int x = (unsigned int)clamp((center.x + 1.f) * 0.5f * 32767.f, 0.f, 32767.f);
+		unsigned int y = (unsigned int)clamp((center.y + 1.f) * 0.5f * 32767.f, 0.f, 32767.f);
+
+		d_sort_keys[id] = (expand_bits(x) << 1) | expand_bits(y);
+		d_sort_values[id] = id;
+	}
+}
+
+/*
+	Length of the common prefix of the sorted keys i and j, -1 if j is out of range.
+
+	Equal keys are told apart by their index, so every key is unique as far as the tree is concerned.
+*/
+int common_prefix(__global const unsigned int* keys, int i, int j, int count) {
+	if (j < 0 || j >= count) return -1;
+
+	unsigned int key_i = keys[i];
+	unsigned int key_j = keys[j];
+	if (key_i == key_j) return 32 + clz(i ^ j);
+	return clz(key_i ^ key_j);
+}
+
+/*
+	Linear BVH, pass 2: builds the hierarchy over the sorted Morton codes (Karras, 2012).
+
+	Internal nodes are numbered [0, count - 1), the root being 0, and leaves [count - 1, 2 * count - 1),
+	in sorted order. Every internal node finds the range of keys it covers and where that range
+	splits, all independently of each other.
+*/
+__kernel void lbvh_build(__global const unsigned int* d_sort_keys, __global unsigned int* d_bvh_children, __global unsigned int* d_bvh_parents,
+	unsigned int balls_count) {
+	int i = get_global_id(0);
+	int count = balls_count;
+	if (i < count - 1) {
+		// direction of the range: towards the neighbour sharing the longest prefix.
+		int d = common_prefix(d_sort_keys, i, i + 1, count) - common_prefix(d_sort_keys, i, i - 1, count) >= 0 ? 1 : -1;
+
+		// upper bound of the range length, then binary search of the other end.
+		int min_prefix = common_prefix(d_sort_keys, i, i - d, count);
+		int max_length = 2;
+		while (common_prefix(d_sort_keys, i, i + max_length * d, count) > min_prefix) max_length *= 2;
+
+		int length = 0;
+		for (int t = max_length / 2; t >= 1; t /= 2) {
+			if (common_prefix(d_sort_keys, i, i + (length + t) * d, count) > min_prefix) length += t;
+		}
+		int j = i + length * d;
+
+		// binary search of the split: the last key sharing more than the node's prefix with i.
+		int node_prefix = common_prefix(d_sort_keys, i, j, count);
+		int split = 0;
+		int t = length;
+		do {
+			t = (t + 1) / 2;
+			if (common_prefix(d_sort_keys, i, i + (split + t) * d, count) > node_prefix) split += t;
+		} while (t > 1);
+		int gamma = i + split * d + min(d, 0);
+
+		unsigned int left = min(i, j) == gamma ? count - 1 + gamma : gamma;
+		unsigned int right = max(i, j) == gamma + 1 ? count + gamma : gamma + 1;
+
+		d_bvh_children[2 * i] = left;
+		d_bvh_children[2 * i + 1] = right;
+		d_bvh_parents[left] = i;
+		d_bvh_parents[right] = i;
+		if (i == 0) d_bvh_parents[0] = 0xffffffff;
+	}
+}
+
+/*
+	Linear BVH, pass 3: computes the bounding box of every node, bottom-up.
+
+	Every leaf writes its own box then climbs towards the root. At each internal node, the first
+	of the two children to arrive stops; the second one, knowing both boxes are written, merges
+	them and keeps climbing. d_bvh_flags must be zeroed beforehand. Leaf boxes are widened by
+	half the skin when building neighbour lists.
+*/
+__kernel void lbvh_bounds(BALL_PARAMS __global const unsigned int* d_sort_values, __global const unsigned int* d_bvh_children,
+	__global const unsigned int* d_bvh_parents, __global float4* d_bvh_bounds, __global unsigned int* d_bvh_flags, float skin,
+	unsigned int balls_count) {
+	unsigned int slot = get_global_id(0);
+	if (slot < balls_count) {
+		unsigned int id = d_sort_values[slot];
+		float2 center = d_center[id];
+		float extent = d_radius[id] + 0.5f * skin;
+
+		unsigned int leaf = balls_count - 1 + slot;
+		d_bvh_bounds[leaf] = (float4)(center.x - extent, center.y - extent, center.x + extent, center.y + extent);
+
+		unsigned int node = d_bvh_parents[leaf];
+		while (node != 0xffffffff) {
+			mem_fence(CLK_GLOBAL_MEM_FENCE);
+			if (atomic_inc(&d_bvh_flags[node]) == 0) return;
+
+			float4 left = ((volatile __global float4*)d_bvh_bounds)[d_bvh_children[2 * node]];
+			float4 right = ((volatile __global float4*)d_bvh_bounds)[d_bvh_children[2 * node + 1]];
+			d_bvh_bounds[node] = (float4)(fmin(left.x, right.x), fmin(left.y, right.y), fmax(left.z, right.z), fmax(left.w, right.w));
+
+			node = d_bvh_parents[node];
+		}
+	}
+}
+
+/*
+	Linear BVH, pass 4: every ball walks the tree with its bounding box and hands the balls of the
+	leaves it overlaps to the narrow-phase. Each pair is handled once, by its lowest ball index.
+*/
+__kernel void lbvh_collide(BALL_PARAMS __global const unsigned int* d_sort_values, __global const unsigned int* d_bvh_children,
+	__global const float4* d_bvh_bounds, float skin, __global unsigned int* d_neighbours, __global unsigned int* d_neighbour_counts,
+	__global unsigned int* d_flags, unsigned int balls_count) {
+	unsigned int slot = get_global_id(0);
+	if (slot < balls_count) {
+		unsigned int id = d_sort_values[slot];
+		unsigned int neighbours_count = 0;
+		float4 box = d_bvh_bounds[balls_count - 1 + slot];
+
+		// a single ball is its own root, there is nothing to traverse.
+		unsigned int stack[BVH_STACK_SIZE];
+		int top = 0;
+		if (balls_count > 1) stack[top++] = 0;
+
+		while (top > 0) {
+			unsigned int node = stack[--top];
+			float4 bounds = d_bvh_bounds[node];
+
+			if (box.x > bounds.z || box.z < bounds.x || box.y > bounds.w || box.w < bounds.y) continue;
+
+			if (node >= balls_count - 1) {
+				unsigned int other_id = d_sort_values[node - (balls_count - 1)];
+				if (other_id > id) handle_pair(BALL_ARGS id, other_id, skin, d_neighbours, &neighbours_count);
+			}
+			else if (top + 2 <= BVH_STACK_SIZE) {
+				stack[top++] = d_bvh_children[2 * node];
+				stack[top++] = d_bvh_children[2 * node + 1];
+			}
+			else {
+				// the subtree is skipped, and its collisions missed.
+				d_flags[FLAG_STACK_OVERFLOW] = 1;
+			}
+		}
+
+		if (d_neighbours) d_neighbour_counts[id] = neighbours_count;
+	}
+}
+
+/*
+	Neighbour lists, rebuild check: flags a rebuild as soon as one ball has moved more than half
+	the skin since the lists were built, as two such balls may now touch without being listed.
+
+	d_flags[FLAG_REBUILD] must be zeroed beforehand.
+*/
+__kernel void verlet_check(BALL_PARAMS __global const float2* d_build_centers, __global unsigned int* d_flags,
+	float skin, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		float2 moved = d_center[id] - d_build_centers[id];
+		if (4.f * dot(moved, moved) > skin * skin) d_flags[FLAG_REBUILD] = 1;
+	}
+}
+
+/*
+	Neighbour lists, after a rebuild: remembers where every ball was when the lists were built.
+*/
+__kernel void verlet_snapshot(BALL_PARAMS __global float2* d_build_centers, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		d_build_centers[id] = d_center[id];
+	}
+}
+
+/*
+	Neighbour lists, every frame: narrow-phase of every ball against its listed neighbours only.
+
+	Flags FLAG_LIST_OVERFLOW if a list overflowed during the last rebuild.
+*/
+__kernel void verlet_collide(BALL_PARAMS __global const unsigned int* d_neighbours, __global const unsigned int* d_neighbour_counts,
+	__global unsigned int* d_flags, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		__global const unsigned int* neighbours = &d_neighbours[id * MAX_NEIGHBOURS];
+
+		unsigned int neighbours_count = d_neighbour_counts[id];
+		if (neighbours_count > MAX_NEIGHBOURS) {
+			d_flags[FLAG_LIST_OVERFLOW] = 1;
+			neighbours_count = MAX_NEIGHBOURS;
+		}
+
+		for (unsigned int i = 0; i < neighbours_count; ++i) {
+			collide(BALL_ARGS id, neighbours[i]);
+		}
+	}
+}
+
+/*
+	Returns true if the two balls overlap.
+*/
+bool touching(BALL_PARAMS unsigned int id, unsigned int other_id) {
+	float2 c = d_center[id] - d_center[other_id];
+	float min_dist = d_radius[id] + d_radius[other_id];
+	return dot(c, c) <= min_dist * min_dist;
+}
+
+/*
+	Contacts, pass 1: counts the listed neighbours every ball actually touches.
+	Flags FLAG_LIST_OVERFLOW if a list overflowed during the last rebuild.
+
+	d_contact_starts has one more slot than there are balls, so that once scanned it also
+	holds the end of the last ball's range (the total), and must be zeroed beforehand. With
+	both, every contact is also counted in the range of the other ball.
+*/
+__kernel void contact_count(BALL_PARAMS __global const unsigned int* d_neighbours, __global const unsigned int* d_neighbour_counts,
+	__global unsigned int* d_contact_starts, __global unsigned int* d_flags, unsigned int both, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		__global const unsigned int* neighbours = &d_neighbours[id * MAX_NEIGHBOURS];
+		unsigned int neighbours_count = d_neighbour_counts[id];
+		if (neighbours_count > MAX_NEIGHBOURS) {
+			d_flags[FLAG_LIST_OVERFLOW] = 1;
+			neighbours_count = MAX_NEIGHBOURS;
+		}
+
+		unsigned int contacts_count = 0;
+		for (unsigned int i = 0; i < neighbours_count; ++i) {
+			unsigned int other_id = neighbours[i];
+			if (touching(BALL_ARGS id, other_id)) {
+				++contacts_count;
+				if (both) atomic_inc(&d_contact_starts[other_id]);
+			}
+		}
+
+		if (contacts_count) atomic_add(&d_contact_starts[id], contacts_count);
+	}
+}
+
+/*
+	Contacts, pass 2: writes the contacts of every ball, as (ball, other ball), in its range of
+	the scanned starts. With both, every contact is also written the other way around in the
+	range of the other ball. Contacts past contacts_capacity are dropped and flagged.
+
+	d_contact_cursors starts as a copy of the scanned starts and is used as the insertion cursor.
+*/
+__kernel void contact_write(BALL_PARAMS __global const unsigned int* d_neighbours, __global const unsigned int* d_neighbour_counts,
+	__global unsigned int* d_contact_cursors, __global uint2* d_contacts, __global unsigned int* d_flags, unsigned int both,
+	unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		__global const unsigned int* neighbours = &d_neighbours[id * MAX_NEIGHBOURS];
+		unsigned int neighbours_count = min(d_neighbour_counts[id], (unsigned int)MAX_NEIGHBOURS);
+
+		for (unsigned int i = 0; i < neighbours_count; ++i) {
+			unsigned int other_id = neighbours[i];
+			if (touching(BALL_ARGS id, other_id)) {
+				unsigned int slot = atomic_inc(&d_contact_cursors[id]);
+				if (slot < contacts_capacity) d_contacts[slot] = (uint2)(id, other_id);
+				else d_flags[FLAG_CONTACT_OVERFLOW] = 1;
+
+				if (both) {
+					slot = atomic_inc(&d_contact_cursors[other_id]);
+					if (slot < contacts_capacity) d_contacts[slot] = (uint2)(other_id, id);
+					else d_flags[FLAG_CONTACT_OVERFLOW] = 1;
+				}
+			}
+		}
+	}
+}
+
+/*
+	Warm start: every contact takes the accumulated impulse it ended the previous frame with,
+	looked up by its pair of balls in the previous contact buffer (new contacts start at 0).
+
+	The pair is searched in the previous range of both its balls, since which ball finds a
+	pair may change from frame to frame.
+*/
+__kernel void contact_warm_start(__global const uint2* d_contacts, __global const unsigned int* d_contact_starts,
+	__global const uint2* d_prev_contacts, __global const unsigned int* d_prev_starts, __global const float* d_prev_impulses,
+	__global float* d_impulses, unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int end = min(d_contact_starts[id + 1], contacts_capacity);
+
+		for (unsigned int k = d_contact_starts[id]; k < end; ++k) {
+			unsigned int other_id = d_contacts[k].y;
+			float impulse = 0.f;
+
+			unsigned int prev_end = min(d_prev_starts[id + 1], contacts_capacity);
+			for (unsigned int p = d_prev_starts[id]; p < prev_end; ++p) {
+				if (d_prev_contacts[p].y == other_id) impulse = d_prev_impulses[p];
+			}
+
+			prev_end = min(d_prev_starts[other_id + 1], contacts_capacity);
+			for (unsigned int p = d_prev_starts[other_id]; p < prev_end; ++p) {
+				if (d_prev_contacts[p].y == id) impulse = d_prev_impulses[p];
+			}
+
+			d_impulses[k] = impulse;
+		}
+	}
+}
+
+/*
+	Returns the relative normal velocity a contact has to reach once solved: fast approaching
+	balls bounce back (restitution), slower ones, like balls resting on each other under
+	gravity, are only stopped so that they do not jitter.
+*/
+float contact_bias(float2 v, float2 n) {
+	float v_n = dot(v, n);
+	return v_n < -RESTING_SPEED ? -RESTITUTION * v_n : 0.f;
+}
+
+/*
+	Sequential impulse step along the contact normal n for the relative velocity v, scaled by
+	weight. Adds it to the accumulated impulse, which is clamped to stay positive since contacts
+	can only push (projection), and returns the part actually applied.
+*/
+float impulse_step(float2 v, float2 n, float inv_mass, float bias, float weight, float* impulse) {
+	float step = weight * (bias - dot(v, n)) / inv_mass;
+	float accumulated = max(*impulse + step, 0.f);
+
+	step = accumulated - *impulse;
+	*impulse = accumulated;
+	return step;
+}
+
+/*
+	Solves the contact between balls id and other_id in place, for the colouring.
+
+	At SOLVE_FIRST, the contact's bias is computed and its warm start impulse applied. Every
+	iteration (SOLVE_FIRST and SOLVE_ITERATION) pushes the balls apart like collide() does
+	and applies one sequential impulse step towards stopping them. Once the iterations are
+	done, a last step goes towards the bias (SOLVE_RESTITUTION). Bouncing at every iteration
+	would keep pushing balls whose contacts have already passed the momentum on, and gain energy.
+*/
+void solve_contact(BALL_PARAMS unsigned int id, unsigned int other_id, __global float* impulse, __global float* bias, unsigned int stage) {
+	float2 center = d_center[id];
+	float2 other_center = d_center[other_id];
+	float2 c = center - other_center;
+	float mag = dot(c, c);
+	if (mag == 0.f) return;
+
+	float dist = sqrt(mag);
+	float2 n = c / dist;
+	float min_dist = d_radius[id] + d_radius[other_id];
+	float inv_mass = d_inv_mass[id];
+	float other_inv_mass = d_inv_mass[other_id];
+	float2 v = d_velocity[id] - d_velocity[other_id];
+	float applied = 0.f;
+
+	if (stage == SOLVE_FIRST) {
+		*bias = contact_bias(v, n);
+		applied = *impulse;
+		v += applied * (inv_mass + other_inv_mass) * n;
+	}
+
+	if (stage != SOLVE_RESTITUTION && dist < min_dist) {
+		float overlap = 0.5f * (dist - min_dist);
+		d_center[id] = center - overlap * n;
+		d_center[other_id] = other_center + overlap * n;
+	}
+
+	float accumulated = *impulse;
+	float target = stage == SOLVE_RESTITUTION ? *bias : 0.f;
+	applied += impulse_step(v, n, inv_mass + other_inv_mass, target, 1.f, &accumulated);
+	*impulse = accumulated;
+
+	d_velocity[id] += applied * inv_mass * n;
+	d_velocity[other_id] -= applied * other_inv_mass * n;
+}
+
+/*
+	Priority of contact k in the colouring round colour: k mixed with the round by the MurmurHash3
+	finalizer. Every step is a bijection, so no two contacts of a round tie, and contacts sorted
+	by ball (a chain of balls in id order) still win in scattered places rather than one at a
+	time from the lowest index (Luby's independent sets).
+*/
+unsigned int claim_priority(unsigned int k, unsigned int colour) {
+	unsigned int h = k ^ (colour * 0x9E3779B9u);
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+	Contact colouring, step 1 of a round: every contact not coloured yet claims both its balls.
+
+	The lowest claim_priority() wins each ball. Work-items go through the contacts of one ball's range.
+	d_claims must be reset to 0xffffffff before every round.
+*/
+__kernel void colour_claim(__global const uint2* d_contacts, __global const unsigned int* d_contact_starts, __global const unsigned int* d_contact_colours,
+	__global unsigned int* d_claims, unsigned int colour, unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int end = min(d_contact_starts[id + 1], contacts_capacity);
+
+		for (unsigned int k = d_contact_starts[id]; k < end; ++k) {
+			if (d_contact_colours[k] == NO_COLOUR) {
+				uint2 contact = d_contacts[k];
+				unsigned int priority = claim_priority(k, colour);
+				atomic_min(&d_claims[contact.x], priority);
+				atomic_min(&d_claims[contact.y], priority);
+			}
+		}
+	}
+}
+
+/*
+	Contact colouring, step 2 of a round: every contact that won both its balls gets this round's
+	colour and is solved right away, for the first time this frame.
+
+	No two contacts of a round share a ball, so the round is free of write conflicts. Contacts that
+	lost a ball wait for a later round and flag FLAG_UNRESOLVED. A round that colours a contact
+	stores its number of colours in FLAG_COLOURS, which ends up holding the colours used.
+*/
+__kernel void colour_resolve(BALL_PARAMS __global const uint2* d_contacts, __global const unsigned int* d_contact_starts,
+	__global unsigned int* d_contact_colours, __global const unsigned int* d_claims, __global float* d_impulses, __global float* d_biases,
+	__global unsigned int* d_flags, unsigned int colour, unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int end = min(d_contact_starts[id + 1], contacts_capacity);
+
+		for (unsigned int k = d_contact_starts[id]; k < end; ++k) {
+			if (d_contact_colours[k] == NO_COLOUR) {
+				uint2 contact = d_contacts[k];
+
+				unsigned int priority = claim_priority(k, colour);
+
+				if (d_claims[contact.x] == priority && d_claims[contact.y] == priority) {
+					solve_contact(BALL_ARGS contact.x, contact.y, &d_impulses[k], &d_biases[k], SOLVE_FIRST);
+					d_contact_colours[k] = colour;
+					d_flags[FLAG_COLOURS] = colour + 1;
+				}
+				else {
+					d_flags[FLAG_UNRESOLVED] = 1;
+				}
+			}
+		}
+	}
+}
+
+/*
+	Solver iterations after the first, with the colouring: one more sequential impulse step
+	for every contact of the given colour, at the given stage (see solve_contact()). Queued
+	colour by colour, this is a Gauss-Seidel sweep over all the contacts.
+*/
+__kernel void colour_solve(BALL_PARAMS __global const uint2* d_contacts, __global const unsigned int* d_contact_starts,
+	__global const unsigned int* d_contact_colours, __global float* d_impulses, __global float* d_biases, unsigned int colour,
+	unsigned int stage, unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		unsigned int end = min(d_contact_starts[id + 1], contacts_capacity);
+
+		for (unsigned int k = d_contact_starts[id]; k < end; ++k) {
+			if (d_contact_colours[k] == colour) {
+				uint2 contact = d_contacts[k];
+				solve_contact(BALL_ARGS contact.x, contact.y, &d_impulses[k], &d_biases[k], stage);
+			}
+		}
+	}
+}
+
+/*
+	Gather resolve, first pass: every ball computes the bias of its contacts, applies their
+	warm start impulses and pushes itself out of the balls it overlaps, writing only its own
+	center and velocity in d_resolved_center and d_resolved_velocity.
+
+	Contacts are written both ways by contact_write, and both copies of a contact see the
+	same state, so they get the same bias and impulse. The position corrections are averaged
+	since they all act at once.
+*/
+__kernel void gather_prepare(BALL_PARAMS __global const uint2* d_contacts, __global const unsigned int* d_contact_starts,
+	__global const float* d_impulses, __global float* d_biases, __global float2* d_resolved_center, __global float2* d_resolved_velocity,
+	unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		float2 center = d_center[id];
+		float2 velocity = d_velocity[id];
+		float radius = d_radius[id];
+		float2 correction = (float2)(0.f, 0.f);
+		float2 warm = (float2)(0.f, 0.f);
+
+		unsigned int start = d_contact_starts[id];
+		unsigned int end = min(d_contact_starts[id + 1], contacts_capacity);
+		for (unsigned int k = start; k < end; ++k) {
+			unsigned int other_id = d_contacts[k].y;
+
+			float2 c = center - d_center[other_id];
+			float mag = dot(c, c);
+			if (mag == 0.f) continue;
+
+			float dist = sqrt(mag);
+			float2 n = c / dist;
+			float2 v = velocity - d_velocity[other_id];
+
+			d_biases[k] = contact_bias(v, n);
+			warm += d_impulses[k] * n;
+			correction -= 0.5f * (dist - radius - d_radius[other_id]) * n;
+		}
+
+		if (end > start) correction /= (float)(end - start);
+		d_resolved_center[id] = center + correction;
+		d_resolved_velocity[id] = velocity + warm * d_inv_mass[id];
+	}
+}
+
+/*
+	Gather resolve, one pass per solver iteration plus one for restitution: every ball takes one
+	sequential impulse step for each of its contacts, at the given stage (see solve_contact()),
+	and writes only its own center and velocity in d_resolved_center and d_resolved_velocity
+	(Jacobi). Iterations also push the ball out of the balls it still overlaps, averaging the
+	corrections like gather_prepare.
+
+	Every step is computed from the state before the pass, and both copies of a contact get the
+	same step, so the two balls see equal and opposite impulses. As all the contacts of a ball act
+	at once, full steps would stack up: each one is weighted by the inverse contact count of the
+	busier of its two balls (the same weight on both sides, so momentum is still conserved).
+*/
+__kernel void gather_resolve(BALL_PARAMS __global const uint2* d_contacts, __global const unsigned int* d_contact_starts,
+	__global float* d_impulses, __global const float* d_biases, __global float2* d_resolved_center, __global float2* d_resolved_velocity,
+	unsigned int stage, unsigned int contacts_capacity, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		float2 center = d_center[id];
+		float2 velocity = d_velocity[id];
+		float radius = d_radius[id];
+		float inv_mass = d_inv_mass[id];
+		float2 applied = (float2)(0.f, 0.f);
+		float2 correction = (float2)(0.f, 0.f);
+
+		unsigned int start = d_contact_starts[id];
+		unsigned int end = min(d_contact_starts[id + 1], contacts_capacity);
+		for (unsigned int k = start; k < end; ++k) {
+			unsigned int other_id = d_contacts[k].y;
+
+			float2 c = center - d_center[other_id];
+			float mag = dot(c, c);
+			if (mag == 0.f) continue;
+
+			float dist = sqrt(mag);
+			float2 n = c / dist;
+			float min_dist = radius + d_radius[other_id];
+			if (stage != SOLVE_RESTITUTION && dist < min_dist)
+				correction -= 0.5f * (dist - min_dist) * n;
+			float2 v = velocity - d_velocity[other_id];
+			unsigned int shares = max(d_contact_starts[id + 1] - start, d_contact_starts[other_id + 1] - d_contact_starts[other_id]);
+
+			float impulse = d_impulses[k];
+			float target = stage == SOLVE_RESTITUTION ? d_biases[k] : 0.f;
+			applied += impulse_step(v, n, inv_mass + d_inv_mass[other_id], target, 1.f / shares, &impulse) * n;
+			d_impulses[k] = impulse;
+		}
+
+		if (end > start) correction /= (float)(end - start);
+		d_resolved_center[id] = center + correction;
+		d_resolved_velocity[id] = velocity + applied * inv_mass;
 	}
 }
 
 /*
 	Updates the vbo to be used by OpenGL to draw the new values computed earlier.
+
+	Every ball is the unit circle d_circle (NUM_POINTS vertices, computed once by the host)
+	scaled by its radius and moved to its center. Only every d_lod_steps[id]-th vertex is
+	written, at the start of the ball's NUM_POINTS slots; a step of NUM_POINTS (a ball less
+	than a pixel across) writes its center alone.
 */
-__kernel void update_vbo(__global struct ball* d_balls, __global float* d_vbo, unsigned int balls_count) { 
+__kernel void update_vbo(BALL_PARAMS __global float2* d_vbo, unsigned int balls_count, __constant float2* d_circle, __global const unsigned int* d_lod_steps) { 
 	int id = get_global_id(0);
 	if (id < balls_count) { 
-		__global struct ball* current = &d_balls[id];
+		float2 center = d_center[id];
+		float radius = d_radius[id];
+		unsigned int step = d_lod_steps[id];
+
+		int idx = id * NUM_POINTS;
 
-		int idx = id * NUM_FLOATS;
+		if (step >= NUM_POINTS) {
+			d_vbo[idx] = center;
+			return;
+		}
 
-		for (int j = 0; j < NUM_POINTS; ++j) {
-			float angle = j * DEGREE_TO_RAD;
-			d_vbo[idx++] = current->radius * cos(angle) + current->center[0]; // x-coord
-			d_vbo[idx++] = current->radius * sin(angle) + current->center[1]; // y-coord
+		for (int j = 0; j * step < NUM_POINTS; ++j) {
+			d_vbo[idx + j] = center + radius * d_circle[j * step];
 		}
 	}
-}
\ No newline at end of file
+}
+
+/*
+	Updates the per-instance buffer used by OpenGL to draw the unit circle mesh (or a point
+	sprite) once per ball: the center and radius of every ball, the last component is unused.
+*/
+__kernel void update_instances(BALL_PARAMS __global float4* d_instances, unsigned int balls_count) {
+	unsigned int id = get_global_id(0);
+	if (id < balls_count) {
+		d_instances[id] = (float4)(d_center[id], d_radius[id], 0.f);
+	}
+}
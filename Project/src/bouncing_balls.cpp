@@ -3,12 +3,33 @@
 #include <freeglut.h>
 #include <cl.h>
 #include <cl_gl.h>
+#include "ball_layout.h"
+#include "cpu_engine.h"
+#include "checkpoint.h"
+// ball_layout_source, ball_init_source and kernel_source, generated from ball_layout.h,
+// ball_init.h and bouncing_balls.cl by embed_sources.ps1 at build time.
+#include "kernel_sources.h"
 #include <string>
 #include <random>
 #include <math.h>
+#include <string.h>
+#include <stdio.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <iomanip>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <GL/glx.h>
+#endif
 
 #define MAX_INFO_LENGTH 1024
 #define DEBUG_LOG_BUFFER_SIZE 16384
@@ -16,72 +37,306 @@
 #define WHEIGHT 800
 #define BALL_COUNT 10
 #define MIN_RADIUS 0.05f
+#define MAX_RADIUS (3 * MIN_RADIUS)
+#define SCAN_BLOCK_SIZE 64
+#define RADIX_BITS 4
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_BLOCK_SIZE 64
+#define BVH_STACK_SIZE 64
+#define MAX_NEIGHBOURS 64
+#define MAX_CONTACTS_PER_BALL 16
+#define MIN_COLOUR_ROUNDS 4
+#define NO_COLOUR 0xffffffff
+#define SOLVE_ITERATION 1
+#define SOLVE_RESTITUTION 2
+#define PROFILE_FRAMES 100
+#define MAX_SHARED_VBOS 3
+// built programs are kept in this directory, under the working directory.
+#define PROGRAM_CACHE_DIR "cl_cache"
+
+// vertices of a tessellated ball, handed to bouncing_balls.cl in the build options
+// (see program_options()). Override with /D NUM_POINTS=n.
+#ifndef NUM_POINTS
 #define NUM_POINTS 360
+#endif
+
+// level of detail of the polygons: target length of an edge on screen (pixels), and fewest
+// vertices of a ball drawn as a polygon. Balls less than a pixel across are drawn as a point.
+#define LOD_EDGE_PIXELS 2.f
+#define LOD_MIN_POINTS 8
+
+// room left between the squares of the lattice, so that the rounding of the centers, a few
+// float steps of the box, cannot make neighbours overlap.
+#define LATTICE_GAP 1e-6f
+
+// make_ball(), shared with the init_balls kernel, after the MIN_RADIUS it uses.
+#include "ball_init.h"
+
+// d_flags slots, read back by the host.
+#define FLAG_REBUILD 0
+#define FLAG_LIST_OVERFLOW 1
+#define FLAG_CONTACT_OVERFLOW 2
+#define FLAG_UNRESOLVED 3
+#define FLAG_STACK_OVERFLOW 4
+#define FLAG_COLOURS 5
+#define FLAGS_COUNT 6
+
+// broad-phase used to find the candidate pairs handed to the narrow-phase.
+enum class broadphase {
+	brute_force,	// every unique pair, O(N^2)
+	uniform_grid,	// counting sort into a uniform grid, 3x3 neighbourhood search
+	sort_and_sweep,	// radix sort on the left edge, sweep forward along x
+	linear_bvh		// radix sort on Morton codes, bounding volume hierarchy rebuilt every frame
+};
 
-struct ball {
-	ball() = default;
-	ball(float r, cl_float2 c, cl_float2 vel, int m)
-		:
-		radius(r),
-		mass(m)
-	{
-		if (radius == 0.05f) {
-			color[0] = 0.5f;
-			color[1] = 1.f;
-			color[2] = 0.5f;
-		}
-		else if (radius == 0.1f) {
-			color[0] = 0.5f;
-			color[1] = 0.5f;
-			color[2] = 1.f;
-		}
-		else {
-			color[0] = 1.f;
-			color[1] = 0.5f;
-			color[2] = 0.5f;
-		}
-		center[0] = c.x;
-		center[1] = c.y;
-		velocity[0] = vel.x;
-		velocity[1] = vel.y;
-	}
+// how the narrow-phase applies the collisions it finds.
+enum class resolve {
+	direct,	// every work-item updates both balls of its pairs as it finds them (racy)
+	colour,	// contacts are coloured so that no two contacts of a batch share a ball
+	gather	// contacts are written for both balls, every ball sums its own response
+};
+
+// what runs the simulation.
+enum class backend {
+	opencl,	// the kernels of bouncing_balls.cl on the chosen device
+	cpu		// the native engine of cpu_engine.cpp on the host's threads, no OpenCL call at all
+};
 
-	float color[3];
-	float center[2];
-	float velocity[2];
-	float radius;
-	int mass;
+// how the balls are drawn.
+enum class render {
+	polygons,	// update_vbo tessellates every ball into NUM_POINTS vertices, one draw call per ball
+	instanced,	// update_instances writes the center and radius of every ball, one instanced draw of a unit circle
+	points		// same instances drawn as point sprites, the fragment shader cuts the circle out of every square
+};
+
+// where the balls start (see make_ball() and place_on_lattice()).
+enum class placement {
+	random,		// anywhere in the box, overlapping or not
+	lattice		// one square of a jittered lattice each, as wide as the ball, never overlapping
+};
+
+// host copy of the ball fields (see ball_layout.h), one array per field.
+struct ball_fields {
+#define BALL_HOST_FIELD(type, name) std::vector<cl_##type> name;
+	BALL_FIELDS(BALL_HOST_FIELD)
+#undef BALL_HOST_FIELD
 };
 
 const float UPDATE_FREQ = 1.f / 30;
+// longest frame time simulated at once, so that a stall does not snowball into longer and longer frames.
+const float MAX_FRAME_TIME = 0.25f;
 const int NUM_FLOATS = NUM_POINTS * 2;
+const float PI = 3.141592f;
+
+// instanced rendering: moves and scales the unit circle mesh to every ball.
+const char* CIRCLE_VERTEX_SHADER = R"(
+#version 120
+attribute vec2 vertex;
+attribute vec4 instance;
+attribute vec3 color;
+varying vec3 ball_color;
+
+void main() {
+	gl_Position = vec4(instance.xy + instance.z * vertex, 0.0, 1.0);
+	ball_color = color;
+}
+)";
+
+const char* CIRCLE_FRAGMENT_SHADER = R"(
+#version 120
+varying vec3 ball_color;
+
+void main() {
+	gl_FragColor = vec4(ball_color, 0.25);
+}
+)";
+
+// point sprites: one vertex per ball, as wide as the ball on screen.
+const char* POINT_VERTEX_SHADER = R"(
+#version 120
+attribute vec4 instance;
+attribute vec3 color;
+uniform float pixels_per_unit;
+varying vec3 ball_color;
+
+void main() {
+	gl_Position = vec4(instance.xy, 0.0, 1.0);
+	gl_PointSize = 2.0 * instance.z * pixels_per_unit;
+	ball_color = color;
+}
+)";
+
+// discards the corners of the sprite: the ball is the disc inscribed in it.
+const char* POINT_FRAGMENT_SHADER = R"(
+#version 120
+varying vec3 ball_color;
+
+void main() {
+	vec2 offset = 2.0 * gl_PointCoord - 1.0;
+	if (dot(offset, offset) > 1.0) discard;
+	gl_FragColor = vec4(ball_color, 0.25);
+}
+)";
+
+// global memory traffic per work-item (bytes) of the kernels whose traffic does not depend on the
+// scene, which gives their effective bandwidth when profiling. update_vbo's is set from the level
+// of detail (see update_lod()).
+std::map<std::string, size_t> kernel_traffic = {
+	// center, velocity and radius in, center and velocity out.
+	{ "wall_bounce", 2 * 2 * sizeof(cl_float2) + sizeof(cl_float) },
+	// center and radius of both balls of the pair in.
+	{ "ball_bounce", 2 * (sizeof(cl_float2) + sizeof(cl_float)) },
+	// center in, cell id out, cell count incremented.
+	{ "grid_count", sizeof(cl_float2) + 2 * sizeof(cl_uint) },
+	// center and radius in, sort key and value out.
+	{ "sap_keys", sizeof(cl_float2) + sizeof(cl_float) + 2 * sizeof(cl_uint) },
+	// center in, sort key and value out.
+	{ "lbvh_morton", sizeof(cl_float2) + 2 * sizeof(cl_uint) },
+	// center and center at the last rebuild in.
+	{ "verlet_check", 2 * sizeof(cl_float2) },
+	// center in, center at the last rebuild out.
+	{ "verlet_snapshot", 2 * sizeof(cl_float2) },
+	// center, radius and vertex step in, NUM_POINTS vertices out at full detail (the unit circle
+	// table is in constant memory).
+	{ "update_vbo", sizeof(cl_float2) + sizeof(cl_float) + sizeof(cl_uint) + NUM_FLOATS * sizeof(float) },
+	// center and radius in, one instance out.
+	{ "update_instances", sizeof(cl_float2) + sizeof(cl_float) + sizeof(cl_float4) }
+};
 
 //////////Host variables//////////
-ball* balls = nullptr;
-unsigned int* pairs = nullptr;
+ball_fields balls;
+// render only, never uploaded.
+std::vector<cl_float3> colors;
 size_t balls_count, pairs_count;
-size_t balls_size, pairs_size;
+// the scene: the same seed makes the same balls, on either backend.
+unsigned long long seed;
+bool seed_requested = false;
+// steps simulated since the scene was made, counted on from a restored checkpoint.
+long long simulated_steps = 0;
+// --checkpoint: the state is saved there every checkpoint_every steps (and at the end of a
+// headless run). --restore: the checkpoint the balls come from, mapped until they are made.
+std::string checkpoint_path, restore_path;
+long long checkpoint_every = 0;
+// simulated_steps at the last checkpoint saved.
+long long saved_steps = -1;
+mapped_file restored;
+// where the balls start, and whether --placement asked for it.
+placement placement_mode = placement::lattice;
+bool placement_requested = false;
 clock_t previous_t = 0, current_t = 0;
 float delta_t = UPDATE_FREQ;
+int substeps = 1;
+float step_t = UPDATE_FREQ, accumulated_t = 0.f;
+// compiled into the kernels (see program_options()): vertical acceleration, and the bounce of
+// solved contacts approaching faster than resting_speed.
+float gravity = -1.5f, restitution = 1.f, resting_speed = 0.1f;
+broadphase broadphase_mode = broadphase::uniform_grid;
+cl_uint grid_dim, cells_count;
+float cell_size;
+float skin = 0.f;
+resolve resolve_mode = resolve::direct;
+bool neighbour_lists = false, lists_built = false;
+bool list_overflow_reported = false, contact_overflow_reported = false, stack_overflow_reported = false;
+cl_uint contacts_capacity;
+size_t scan_capacity = 0;
+int solver_iterations = 1;
+bool warm_starting = true;
+render render_mode = render::instanced;
+// polygons: every ball uses every lod_steps[i]-th vertex of the unit circle, lod_counts[i] in all,
+// chosen for the viewport lod_width pixels wide.
+bool lod = true;
+std::vector<cl_uint> lod_steps;
+std::vector<GLsizei> lod_counts;
+GLint lod_width = 0;
+bool profiling = false, check_momentum = false;
+backend backend_mode = backend::opencl;
+// CPU backend: worker threads (0 for every hardware thread) and instruction set.
+unsigned int cpu_threads = 0;
+simd simd_mode = simd::scalar;
+// cpu_steals() at the last profile printed.
+size_t reported_steals = 0;
+// CPU backend, polygons: the unit circle update_vbo's work is done from.
+std::vector<cl_float2> circle_table;
+// --headless: no window and no GL, headless_steps steps as fast as possible (see run_headless()).
+bool headless = false;
+long long headless_steps = 1000;
+// --platform and --device, counted from 1 as listed (0 asks, or picks the first GPU when headless).
+int platform_choice = 0, device_choice = 0;
+// shared VBOs in rotation: CL writes one while GL draws the one written the frame before.
+int shared_vbos = 2, written_vbo = 0;
+// GL/CL handoff through sync objects where the driver has them (see create_sync_objects()),
+// and the time the host spent in the handoff (mostly waiting) since the last profile.
+bool sync_objects = true;
+double host_wait_time = 0;
+// program binaries cached on disk (see create_program()).
+bool program_cache = true;
+int profiled_frames = 0, list_rebuilds = 0, checked_frames = 0;
+cl_uint max_colour_rounds = 0;
+// colours the contacts needed in the last frame, the rounds queued before the first check.
+cl_uint colours_used = 0;
+double max_momentum_drift = 0;
+std::vector<std::pair<cl_kernel, cl_event>> profiled_events;
+std::vector<size_t> profiled_sizes;
+std::map<std::string, double> kernel_times;
+std::map<std::string, size_t> kernel_items;
 
 /////////Device variables/////////
-GLuint vbo;
+// vbos are shared with CL: the tessellated balls, or one instance per ball. vbo is the one drawn.
+GLuint vbos[MAX_SHARED_VBOS] = {}, vbo = 0;
+GLuint circle_vbo = 0, color_vbo = 0, circle_program = 0;
+GLint vertex_location, instance_location, color_location, pixels_per_unit_location;
 cl_context context = nullptr;
 cl_device_id device = nullptr;
 cl_command_queue cmd_q = nullptr;
 cl_program program = nullptr;
-cl_mem d_balls = nullptr, d_pairs = nullptr, d_vbo = nullptr;
-cl_kernel wall_bounce = nullptr, ball_bounce = nullptr, update_vbo = nullptr;
+// builds program while the main thread creates the queue and the buffers.
+std::thread program_builder;
+cl_mem d_vbos[MAX_SHARED_VBOS] = {}, d_circle = nullptr, d_lod_steps = nullptr;
+// released by CL once the vbo is written, nullptr until it first is.
+cl_event vbo_events[MAX_SHARED_VBOS] = {};
+// cl_khr_gl_event: GL fence behind the last draw, as a CL event the acquire of the vbo waits on.
+typedef cl_event (CL_API_CALL *create_event_from_gl_sync_fn)(cl_context, cl_GLsync, cl_int*);
+create_event_from_gl_sync_fn create_event_from_gl_sync = nullptr;
+GLsync vbo_fences[MAX_SHARED_VBOS] = {};
+cl_event fence_events[MAX_SHARED_VBOS] = {};
+// GL_ARB_cl_event: GL waits on the release of the vbo itself instead of the host.
+bool gl_waits_cl = false;
+// one buffer per ball field: d_center, d_velocity, d_radius and d_inv_mass.
+#define BALL_BUFFER(type, name) cl_mem d_##name = nullptr;
+BALL_FIELDS(BALL_BUFFER)
+#undef BALL_BUFFER
+cl_mem d_cell_ids = nullptr, d_cell_starts = nullptr, d_cell_ends = nullptr, d_sorted = nullptr;
+std::vector<cl_mem> d_scan_sums;
+cl_mem d_sort_keys[2] = {}, d_sort_values[2] = {}, d_radix_counts = nullptr;
+cl_mem d_bvh_children = nullptr, d_bvh_parents = nullptr, d_bvh_bounds = nullptr, d_bvh_flags = nullptr;
+cl_mem d_neighbours = nullptr, d_neighbour_counts = nullptr, d_build_centers = nullptr, d_flags = nullptr;
+cl_kernel init_balls = nullptr, wall_bounce = nullptr, ball_bounce = nullptr, update_vbo = nullptr, update_instances = nullptr;
+cl_kernel lattice_classes = nullptr, lattice_place = nullptr;
+cl_kernel scan_blocks = nullptr, scan_add = nullptr;
+cl_kernel grid_count = nullptr, grid_scatter = nullptr, grid_collide = nullptr;
+cl_kernel radix_count = nullptr, radix_scatter = nullptr, sap_keys = nullptr, sap_sweep = nullptr;
+cl_kernel lbvh_morton = nullptr, lbvh_build = nullptr, lbvh_bounds = nullptr, lbvh_collide = nullptr;
+cl_kernel verlet_check = nullptr, verlet_snapshot = nullptr, verlet_collide = nullptr;
+cl_mem d_contact_starts = nullptr, d_contact_cursors = nullptr, d_contacts = nullptr;
+cl_mem d_contact_colours = nullptr, d_claims = nullptr, d_impulses = nullptr, d_biases = nullptr;
+cl_mem d_resolved_center = nullptr, d_resolved_velocity = nullptr;
+cl_mem d_prev_contacts = nullptr, d_prev_starts = nullptr, d_prev_impulses = nullptr;
+cl_kernel contact_count = nullptr, contact_write = nullptr, contact_warm_start = nullptr;
+cl_kernel colour_claim = nullptr, colour_resolve = nullptr, colour_solve = nullptr, gather_prepare = nullptr, gather_resolve = nullptr;
 cl_int status = CL_SUCCESS;
 
 // forward declaration
 void update();
+void restore_checkpoint();
+cl_int place_on_lattice();
+void check_overflows();
 
 /*
 	Creates an OpenCL context after discovering available platforms and devices.
 
-	Polls the users for their choice of platform and device. Once the choices have
-	been made, creates the context.
+	Polls the users for their choice of platform and device, unless given with --platform and
+	--device. Headless, with no one to poll, the first GPU is taken (or else the first device).
+	Once the choices have been made, creates the context.
 */
 void create_context() {
 	status = CL_SUCCESS;
@@ -114,10 +369,30 @@ void create_context() {
 		std::cout << "  Version:\t" << info << std::endl << std::endl;
 	}
 
-	std::cout << "Platform choice: ";
-	int platform_num;
-	std::cin >> platform_num;
-	std::cout << std::endl;
+	int platform_num = platform_choice;
+	if (platform_num == 0 && headless) {
+		platform_num = 1;
+		for (unsigned int i = 0; i < num_platforms; ++i) {
+			cl_uint num_gpus = 0;
+			if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 0, nullptr, &num_gpus) == CL_SUCCESS && num_gpus > 0) {
+				platform_num = i + 1;
+				break;
+			}
+		}
+	}
+	if (platform_num == 0) {
+		std::cout << "Platform choice: ";
+		std::cin >> platform_num;
+		std::cout << std::endl;
+	}
+	else {
+		std::cout << "Platform choice: " << platform_num << std::endl << std::endl;
+	}
+	if (platform_num < 1 || platform_num > (int)num_platforms) {
+		std::cout << "There is no platform " << platform_num << "." << std::endl;
+		delete[] platforms;
+		return;
+	}
 
 	cl_platform_id platform = platforms[platform_num - 1];
 	delete[] platforms;
@@ -162,153 +437,219 @@ void create_context() {
 		std::cout << "  Max Compute Unit:\t" << max_compute_units << std::endl << std::endl;
 	}
 
-	std::cout << "Device choice: ";
-	int device_num;
-	std::cin >> device_num;
-	std::cout << std::endl;
+	int device_num = device_choice;
+	if (device_num == 0 && headless) {
+		device_num = 1;
+		for (unsigned int i = 0; i < num_devices; ++i) {
+			cl_device_type device_type;
+			clGetDeviceInfo(devices[i], CL_DEVICE_TYPE, sizeof(device_type), &device_type, nullptr);
+			if (device_type & CL_DEVICE_TYPE_GPU) {
+				device_num = i + 1;
+				break;
+			}
+		}
+	}
+	if (device_num == 0) {
+		std::cout << "Device choice: ";
+		std::cin >> device_num;
+		std::cout << std::endl;
+	}
+	else {
+		std::cout << "Device choice: " << device_num << std::endl << std::endl;
+	}
+	if (device_num < 1 || device_num > (int)num_devices) {
+		std::cout << "There is no device " << device_num << "." << std::endl;
+		delete[] devices;
+		return;
+	}
 
 	cl_device_id device = devices[device_num - 1];
 	delete[] devices;
 
 	// create the context properties required for OpenCL/OpenGL interoperability.
 	cl_context_properties properties[] = {
+#ifdef _WIN32
 		CL_GL_CONTEXT_KHR, (cl_context_properties)wglGetCurrentContext(),
 		CL_WGL_HDC_KHR, (cl_context_properties)wglGetCurrentDC(),
+#else
+		CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
+		CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+#endif
+		CL_CONTEXT_PLATFORM, (cl_context_properties)platform,
+		0
+	};
+	// headless, there is no GL context to share with.
+	cl_context_properties headless_properties[] = {
 		CL_CONTEXT_PLATFORM, (cl_context_properties)platform,
 		0
 	};
 
-	context = clCreateContext(properties, 1, &device, nullptr, nullptr, &status);
+	context = clCreateContext(headless ? headless_properties : properties, 1, &device, nullptr, nullptr, &status);
 }
 
 /*
-	Creates all the necessary device buffers (both OpenCL and OpenGL buffers for interoperability).
+	Creates the block sum buffers needed to scan up to count values with enqueue_scan().
 
-	For purely CL buffers (that don't operate with GL buffers), data is also copied from host
-	to device.
+	One buffer per level of the scan: each level holds one value per SCAN_BLOCK_SIZE values
+	of the level below, down to a single value which ends up holding the total. Does nothing
+	if the buffers are already big enough, otherwise replaces them.
 */
-cl_int create_clgl_buffers() {
+cl_int create_scan_buffers(size_t count) {
 	status = CL_SUCCESS;
+	if (count <= scan_capacity) return status;
 
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, balls_count * NUM_FLOATS * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	for (cl_mem sums : d_scan_sums) clReleaseMemObject(sums);
+	d_scan_sums.clear();
+	scan_capacity = count;
 
-	d_vbo = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, vbo, &status);
-	if (status != CL_SUCCESS || d_vbo == nullptr) {
-		std::cout << "Failed to associate CL buffer to GL buffer." << std::endl;
-		return status;
-	}
+	do {
+		count = (count + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+
+		cl_mem sums = clCreateBuffer(context, CL_MEM_READ_WRITE, count * sizeof(cl_uint), nullptr, &status);
+		if (status != CL_SUCCESS || sums == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
+		d_scan_sums.push_back(sums);
+	} while (count > 1);
 
-	d_balls = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_size, nullptr, &status);
-	if (status != CL_SUCCESS || d_balls == nullptr) {
+	return status;
+}
+
+/*
+	Creates the buffers of the uniform grid broad-phase.
+
+	The grid covers the [-1, 1] box with cells as wide as the largest ball (plus the skin of
+	the neighbour lists), so every ball only has to be tested against the balls of its 3x3
+	neighbouring cells.
+*/
+cl_int create_grid_buffers() {
+	status = CL_SUCCESS;
+
+	cell_size = 2 * MAX_RADIUS + skin;
+	grid_dim = (cl_uint)ceil(2.f / cell_size);
+	cells_count = grid_dim * grid_dim;
+
+	d_cell_ids = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_cell_ids == nullptr) {
 		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
-	status = clEnqueueWriteBuffer(cmd_q, d_balls, CL_TRUE, 0, balls_size, balls, 0, nullptr, nullptr);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to write data to device memory." << std::endl;
+
+	d_sorted = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_sorted == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	d_pairs = clCreateBuffer(context, CL_MEM_READ_WRITE, pairs_size, nullptr, &status);
-	if (status != CL_SUCCESS || d_pairs == nullptr) {
+	d_cell_starts = clCreateBuffer(context, CL_MEM_READ_WRITE, cells_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_cell_starts == nullptr) {
 		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	status = clEnqueueWriteBuffer(cmd_q, d_pairs, CL_TRUE, 0, pairs_size, pairs, 0, nullptr, nullptr);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to write data to device memory." << std::endl;
+	d_cell_ends = clCreateBuffer(context, CL_MEM_READ_WRITE, cells_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_cell_ends == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	return status;
+	return create_scan_buffers(cells_count);
 }
 
 /*
-	Creates and builds an OpenCL program from file_name which contains the CL kernels.
+	Creates the key/value buffers (two of each, to ping-pong between) and the digit counts needed
+	to radix sort up to count values with enqueue_radix_sort().
 */
-void create_program(cl_uint num_devices, const char* file_name) {
-	// attempt to open kernel file.
-	std::ifstream kernel(file_name, std::ifstream::in);
-	if (!kernel.is_open()) {
-		std::cout << "Failed to open kernel file." << std::endl;
-		return;
-	}
-	//////read file content into string//////
-	std::ostringstream buff;
-	buff << kernel.rdbuf();
+cl_int create_sort_buffers(size_t count) {
+	status = CL_SUCCESS;
 
-	std::string s = buff.str();
-	const char* kernels = s.c_str();
-	/////////////////////////////////////////
+	for (int i = 0; i < 2; ++i) {
+		d_sort_keys[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, count * sizeof(cl_uint), nullptr, &status);
+		if (status != CL_SUCCESS || d_sort_keys[i] == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
 
-	program = clCreateProgramWithSource(context, 1, (const char**)&kernels, nullptr, &status);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to create CL program from source file " << file_name << std::endl;
-		return;
+		d_sort_values[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, count * sizeof(cl_uint), nullptr, &status);
+		if (status != CL_SUCCESS || d_sort_values[i] == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
 	}
 
-	status = clBuildProgram(program, num_devices, &device, nullptr, nullptr, nullptr);
-	if (status != CL_SUCCESS) {
-		char log[DEBUG_LOG_BUFFER_SIZE];
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(log), log, nullptr);
-
-		std::cout << "Failed to build CL program." << std::endl;
-		std::cerr << log;
-		clReleaseProgram(program);
+	size_t radix_counts = RADIX_SIZE * ((count + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE);
+	d_radix_counts = clCreateBuffer(context, CL_MEM_READ_WRITE, radix_counts * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_radix_counts == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
 	}
+
+	return create_scan_buffers(radix_counts);
 }
 
 /*
-	Creates all the OpenCL kernels to be used in the OpenCL program.
+	Creates the buffers of the linear BVH broad-phase: the sort buffers for the Morton codes,
+	and the children, parent, bounding box and visit flag of every node.
 
-	Also sets the kernel arguments.
+	The tree has balls_count leaves and balls_count - 1 internal nodes.
 */
-cl_int create_kernels() {
-	status = CL_SUCCESS;
+cl_int create_bvh_buffers() {
+	status = create_sort_buffers(balls_count);
+	if (status != CL_SUCCESS) return status;
 
-	wall_bounce = clCreateKernel(program, "wall_bounce", &status);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to create kernel from program." << std::endl;
+	size_t internal_count = balls_count > 1 ? balls_count - 1 : 1;
+	size_t nodes_count = internal_count + balls_count;
+
+	d_bvh_children = clCreateBuffer(context, CL_MEM_READ_WRITE, 2 * internal_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_bvh_children == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	status = clSetKernelArg(wall_bounce, 0, sizeof(cl_mem), &d_balls);
-	status |= clSetKernelArg(wall_bounce, 1, sizeof(float), &delta_t);
-	status |= clSetKernelArg(wall_bounce, 2, sizeof(unsigned int), &balls_count);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to set kernel args." << std::endl;
+	d_bvh_parents = clCreateBuffer(context, CL_MEM_READ_WRITE, nodes_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_bvh_parents == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	ball_bounce = clCreateKernel(program, "ball_bounce", &status);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to create kernel from program." << std::endl;
+	d_bvh_bounds = clCreateBuffer(context, CL_MEM_READ_WRITE, nodes_count * sizeof(cl_float4), nullptr, &status);
+	if (status != CL_SUCCESS || d_bvh_bounds == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	status = clSetKernelArg(ball_bounce, 0, sizeof(cl_mem), &d_pairs);
-	status |= clSetKernelArg(ball_bounce, 1, sizeof(cl_mem), &d_balls);
-	status |= clSetKernelArg(ball_bounce, 2, sizeof(unsigned int), &pairs_count);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to set kernel args." << std::endl;
+	d_bvh_flags = clCreateBuffer(context, CL_MEM_READ_WRITE, internal_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_bvh_flags == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	update_vbo = clCreateKernel(program, "update_vbo", &status);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to create kernel from program." << std::endl;
+	return status;
+}
+
+/*
+	Creates the buffers of the neighbour lists: MAX_NEIGHBOURS slots and a count per ball, and
+	the centers at the last rebuild.
+*/
+cl_int create_verlet_buffers() {
+	status = CL_SUCCESS;
+
+	d_neighbours = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * MAX_NEIGHBOURS * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_neighbours == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
-	status = clSetKernelArg(update_vbo, 0, sizeof(cl_mem), &d_balls);
-	status |= clSetKernelArg(update_vbo, 1, sizeof(cl_mem), &d_vbo);
-	status |= clSetKernelArg(update_vbo, 2, sizeof(unsigned int), &balls_count);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to set kernel args." << std::endl;
+	d_neighbour_counts = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_neighbour_counts == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
+	}
+
+	d_build_centers = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_float2), nullptr, &status);
+	if (status != CL_SUCCESS || d_build_centers == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
 		return status;
 	}
 
@@ -316,186 +657,2749 @@ cl_int create_kernels() {
 }
 
 /*
-	Initializes the display, balls and unique ball pairs.
+	Creates the buffers of the contact stage: the contacts of every ball (MAX_CONTACTS_PER_BALL
+	on average) with their range starts, insertion cursors, accumulated impulses and biases.
+	The colouring adds the contact colours and one claim per ball, the gather resolve a second
+	copy of the centers and velocities to write to. Warm starting keeps the contacts of the previous frame.
 */
-void init(int argc, char** argv) {
-	//////////////////////////init display//////////////////////////
-	glutInit(&argc, argv);
-	glutInitWindowPosition(-1, -1);
-	glutInitWindowSize(WWIDTH, WHEIGHT);
-	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_ALPHA);
-	glutCreateWindow("Bouncing Balls Simulation");
-	glewInit();
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_BLEND);
-	glutDisplayFunc(update);
-	glutIdleFunc(update);
-	////////////////////////////////////////////////////////////////
-
-	///////////////////////////init balls///////////////////////////
-	balls_count = argc > 1 ? std::stoi(argv[1]) : BALL_COUNT;
-	balls = new ball[balls_count];
+cl_int create_contact_buffers() {
+	status = CL_SUCCESS;
+	contacts_capacity = (cl_uint)(balls_count * MAX_CONTACTS_PER_BALL);
 
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<int> rad(1, 3);
-	std::uniform_real_distribution<float> vel(-1.f, 1.f);
+	// one more start than balls, for the end of the last range.
+	d_contact_starts = clCreateBuffer(context, CL_MEM_READ_WRITE, (balls_count + 1) * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_contact_starts == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
+	}
 
-	for (unsigned int i = 0; i < balls_count; ++i) {
-		int test = rad(gen);
-		float radius = MIN_RADIUS * test; // random radius
+	d_contact_cursors = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_contact_cursors == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
+	}
 
-		float ur_bound = radius - 1;
-		float ll_bound = 1 - radius;
+	d_contacts = clCreateBuffer(context, CL_MEM_READ_WRITE, contacts_capacity * sizeof(cl_uint2), nullptr, &status);
+	if (status != CL_SUCCESS || d_contacts == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
+	}
 
-		std::uniform_real_distribution<float> coord(ur_bound, ll_bound); // so we dont get balls out of bounds
-		cl_float2 center = { coord(gen), coord(gen) };
+	d_impulses = clCreateBuffer(context, CL_MEM_READ_WRITE, contacts_capacity * sizeof(float), nullptr, &status);
+	if (status != CL_SUCCESS || d_impulses == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
+	}
 
-		int weight = (int)(radius * 100.0f);
-		cl_float2 velocity = { vel(gen), vel(gen) };
-		balls[i] = ball(radius, center, velocity, weight);
+	d_biases = clCreateBuffer(context, CL_MEM_READ_WRITE, contacts_capacity * sizeof(float), nullptr, &status);
+	if (status != CL_SUCCESS || d_biases == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
 	}
 
-	balls_size = balls_count * sizeof(ball);
-	////////////////////////////////////////////////////////////////
+	if (warm_starting) {
+		d_prev_contacts = clCreateBuffer(context, CL_MEM_READ_WRITE, contacts_capacity * sizeof(cl_uint2), nullptr, &status);
+		if (status != CL_SUCCESS || d_prev_contacts == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
+
+		d_prev_impulses = clCreateBuffer(context, CL_MEM_READ_WRITE, contacts_capacity * sizeof(float), nullptr, &status);
+		if (status != CL_SUCCESS || d_prev_impulses == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
+
+		d_prev_starts = clCreateBuffer(context, CL_MEM_READ_WRITE, (balls_count + 1) * sizeof(cl_uint), nullptr, &status);
+		if (status != CL_SUCCESS || d_prev_starts == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
 
-	///////////////////////////init pairs///////////////////////////
-	for (unsigned int i = 0; i < balls_count; ++i) {
-		for (unsigned int j = (i + 1); j < balls_count; ++j) {
-			++pairs_count;
+		// no contacts before the first frame.
+		cl_uint zero = 0;
+		status = clEnqueueFillBuffer(cmd_q, d_prev_starts, &zero, sizeof(zero), 0, (balls_count + 1) * sizeof(cl_uint), 0, nullptr, nullptr);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to write data to device memory." << std::endl;
+			return status;
 		}
 	}
 
-	pairs = new unsigned int[2 * pairs_count];
+	if (resolve_mode == resolve::colour) {
+		d_contact_colours = clCreateBuffer(context, CL_MEM_READ_WRITE, contacts_capacity * sizeof(cl_uint), nullptr, &status);
+		if (status != CL_SUCCESS || d_contact_colours == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
 
-	int count = 0;
-	for (unsigned int i = 0; i < balls_count; ++i) {
-		for (unsigned int j = (i + 1); j < balls_count; ++j) {
-			pairs[count++] = i;
-			pairs[count++] = j;
+		d_claims = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_uint), nullptr, &status);
+		if (status != CL_SUCCESS || d_claims == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
 		}
 	}
+	else {
+		d_resolved_center = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_float2), nullptr, &status);
+		if (status != CL_SUCCESS || d_resolved_center == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
 
-	pairs_size = pairs_count * sizeof(unsigned int) * 2;
-	////////////////////////////////////////////////////////////////
+		d_resolved_velocity = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_float2), nullptr, &status);
+		if (status != CL_SUCCESS || d_resolved_velocity == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
+	}
+
+	return create_scan_buffers(balls_count + 1);
 }
 
 /*
-	Draws the balls.
+	Returns the NUM_POINTS vertices of the unit circle, counter-clockwise from (1, 0).
 */
-void draw() {
-	glClearColor(0.25f, 0.25f, 0.25f, 1.f);
-	glClear(GL_COLOR_BUFFER_BIT);
+std::vector<cl_float2> unit_circle() {
+	std::vector<cl_float2> circle(NUM_POINTS);
+	for (int j = 0; j < NUM_POINTS; ++j) {
+		float angle = j * 2.f * PI / NUM_POINTS;
+		circle[j] = { cos(angle), sin(angle) };
+	}
+	return circle;
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glVertexPointer(2, GL_FLOAT, 0, 0);
-	for (unsigned int i = 0; i < balls_count; ++i) {
-		ball& ball = balls[i];
-		glColor4f(ball.color[0], ball.color[1], ball.color[2], 0.25f);
-		glDrawArrays(GL_POLYGON, i * NUM_POINTS, NUM_POINTS);
-	}
-	glDisableClientState(GL_VERTEX_ARRAY);
+/*
+	Creates the static buffers of the instanced and point rendering: the colour of every ball
+	and, when instanced, the unit circle mesh as a triangle fan of NUM_POINTS vertices. Neither
+	changes once uploaded.
+*/
+void create_circle_buffers() {
+	if (render_mode == render::instanced) {
+		std::vector<cl_float2> circle = unit_circle();
+
+		glGenBuffers(1, &circle_vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, circle_vbo);
+		glBufferData(GL_ARRAY_BUFFER, NUM_POINTS * sizeof(cl_float2), circle.data(), GL_STATIC_DRAW);
+	}
+
+	glGenBuffers(1, &color_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+	glBufferData(GL_ARRAY_BUFFER, balls_count * sizeof(cl_float3), colors.data(), GL_STATIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	glutSwapBuffers();
+/*
+	Returns the size of a vbo: instanced or as points, only 16 bytes per ball are written
+	instead of NUM_POINTS vertices.
+*/
+size_t vbo_bytes() {
+	return render_mode == render::polygons ? balls_count * NUM_FLOATS * sizeof(float) : balls_count * sizeof(cl_float4);
 }
 
 /*
-	Updates the frame 30 times per second.
+	Creates the vbo the CPU backend writes the balls to every frame, and the static buffers of
+	the render mode.
+*/
+void create_cpu_buffers() {
+	glGenBuffers(1, vbos);
+	glBindBuffer(GL_ARRAY_BUFFER, vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, vbo_bytes(), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	vbo = vbos[0];
 
-	Queues OpenCL kernel calls that will execute on the device to compute
-	ball-wall and ball-ball collisions. It then uses the new values to render
-	the new frame.
+	if (render_mode != render::polygons) {
+		create_circle_buffers();
+		return;
+	}
+
+	circle_table = unit_circle();
+	lod_steps.assign(balls_count, 1);
+	lod_counts.assign(balls_count, NUM_POINTS);
+}
+
+/*
+	Creates the VBOs shared with OpenGL, which CL writes the balls to, and the static buffers
+	of the render mode.
 */
-void update() {
-	//update current clock time
-	current_t = clock();
-	delta_t = (float)(current_t - previous_t) / CLOCKS_PER_SEC;
+cl_int create_shared_buffers() {
+	size_t vbo_size = vbo_bytes();
 
-	// don't draw if delta_t is faster than 30 fps
-	if (delta_t < UPDATE_FREQ) return;
+	glGenBuffers(shared_vbos, vbos);
+	for (int i = 0; i < shared_vbos; ++i) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbos[i]);
+		glBufferData(GL_ARRAY_BUFFER, vbo_size, nullptr, GL_DYNAMIC_DRAW);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	vbo = vbos[0];
 
-	// store last draw time
-	previous_t = current_t;
+	if (render_mode != render::polygons) create_circle_buffers();
 
-	// queue ball-wall collision computation
-	clEnqueueNDRangeKernel(cmd_q, wall_bounce, 1, nullptr, &balls_count, &balls_count, 0, nullptr, nullptr);
-	// queue ball-ball collision computation
-	clEnqueueNDRangeKernel(cmd_q, ball_bounce, 1, nullptr, &pairs_count, &pairs_count, 0, nullptr, nullptr);
-	
-	// wait for all OpenGL routines to finish before acquiring CL/GL shared data.
-	glFinish();
-	// acquire shared data.
-	clEnqueueAcquireGLObjects(cmd_q, 1, &d_vbo, 0, nullptr, nullptr);
-	// queue update_vbo kernel to update vbo values for OpenGL.
-	clEnqueueNDRangeKernel(cmd_q, update_vbo, 1, nullptr, &balls_count, &balls_count, 0, nullptr, nullptr);
-	// release shared data.
-	clEnqueueReleaseGLObjects(cmd_q, 1, &d_vbo, 0, nullptr, nullptr);
-	// wait for all OpenCL routines to finish before letting OpenGL draw.
-	clFinish(cmd_q);
+	for (int i = 0; i < shared_vbos; ++i) {
+		d_vbos[i] = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, vbos[i], &status);
+		if (status != CL_SUCCESS || d_vbos[i] == nullptr) {
+			std::cout << "Failed to associate CL buffer to GL buffer." << std::endl;
+			return status;
+		}
+	}
 
-	draw();
+	// update_vbo moves and scales the unit circle, computed once here.
+	if (render_mode == render::polygons) {
+		std::vector<cl_float2> circle = unit_circle();
+		d_circle = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, NUM_POINTS * sizeof(cl_float2), circle.data(), &status);
+		if (status != CL_SUCCESS || d_circle == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
+
+		// every vertex until the first update_lod().
+		lod_steps.assign(balls_count, 1);
+		lod_counts.assign(balls_count, NUM_POINTS);
+		d_lod_steps = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, balls_count * sizeof(cl_uint), lod_steps.data(), &status);
+		if (status != CL_SUCCESS || d_lod_steps == nullptr) {
+			std::cout << "Failed to allocate a buffer on device." << std::endl;
+			return status;
+		}
+	}
+
+	return status;
 }
 
 /*
-	Frees all the resources.
-*/
-void cleanup() {
-	if (balls) delete[] balls;
-	if (pairs) delete[] pairs;
-	if (vbo) glDeleteBuffers(1, &vbo);
-	if (d_balls) clReleaseMemObject(d_balls);
-	if (d_pairs) clReleaseMemObject(d_pairs);
-	if (d_vbo) clReleaseMemObject(d_vbo);
-	if (cmd_q) clReleaseCommandQueue(cmd_q);
-	if (wall_bounce) clReleaseKernel(wall_bounce);
-	if (ball_bounce) clReleaseKernel(ball_bounce);
-	if (update_vbo) clReleaseKernel(update_vbo);
-	if (program) clReleaseProgram(program);
-	if (context) clReleaseContext(context);
-}
+	Creates all the necessary device buffers (both OpenCL and OpenGL buffers for interoperability).
 
-int main(int argc, char** argv) {
-	init(argc, argv);
+	For purely CL buffers (that don't operate with GL buffers), data is also copied from host
+	to device.
+*/
+cl_int create_clgl_buffers() {
+	status = CL_SUCCESS;
 
-	create_context();
-	if (!context) {
-		std::cout << "Failed to create an OpenCL context." << std::endl;
-		cleanup();
-		std::exit(1);
+	if (!headless) {
+		status = create_shared_buffers();
+		if (status != CL_SUCCESS) return status;
 	}
 
-	status = clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, nullptr);
+	// one buffer per ball field, filled by init_balls (see create_balls_on_device()).
+#define CREATE_BALL_BUFFER(type, name) \
+	if (status == CL_SUCCESS) \
+		d_##name = clCreateBuffer(context, CL_MEM_READ_WRITE, balls_count * sizeof(cl_##type), nullptr, &status);
+	BALL_FIELDS(CREATE_BALL_BUFFER)
+#undef CREATE_BALL_BUFFER
 	if (status != CL_SUCCESS) {
-		std::cout << "Failed to get device from context." << std::endl;
-		cleanup();
-		std::exit(1);
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
 	}
 
-	cmd_q = clCreateCommandQueue(context, device, 0, &status);
-	if (status != CL_SUCCESS) {
-		std::cout << "Failed to get device from context." << std::endl;
-		cleanup();
-		std::exit(1);
+	// the flags the kernels raise for the host (see check_overflows()).
+	d_flags = clCreateBuffer(context, CL_MEM_READ_WRITE, FLAGS_COUNT * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_flags == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
 	}
 
-	status = create_clgl_buffers();
+	cl_uint zero = 0;
+	status = clEnqueueFillBuffer(cmd_q, d_flags, &zero, sizeof(zero), 0, FLAGS_COUNT * sizeof(cl_uint), 0, nullptr, nullptr);
 	if (status != CL_SUCCESS) {
-		cleanup();
-		std::exit(1);
+		std::cout << "Failed to write data to device memory." << std::endl;
+		return status;
 	}
 
-	create_program(1, "bouncing_balls.cl");
-	if (!program) {
-		cleanup();
-		std::exit(1);
+	if (broadphase_mode == broadphase::uniform_grid) {
+		status = create_grid_buffers();
+	}
+	else if (broadphase_mode == broadphase::sort_and_sweep) {
+		status = create_sort_buffers(balls_count);
+	}
+	else if (broadphase_mode == broadphase::linear_bvh) {
+		status = create_bvh_buffers();
 	}
+	if (status != CL_SUCCESS) return status;
 
-	status = create_kernels();
-	if (status != CL_SUCCESS) {
-		cleanup();
-		std::exit(1);
+	if (neighbour_lists) {
+		status = create_verlet_buffers();
+		if (status != CL_SUCCESS) return status;
+	}
+
+	if (resolve_mode != resolve::direct) {
+		status = create_contact_buffers();
+	}
+
+	return status;
+}
+
+/*
+	64-bit FNV-1a hash of data, as 16 hex digits.
+*/
+std::string hash_hex(const std::string& data) {
+	unsigned long long hash = 14695981039346656037ull;
+	for (unsigned char c : data) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+
+	std::ostringstream hex;
+	hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return hex.str();
+}
+
+/*
+	Returns what a binary built from source with options depends on: the device, its driver,
+	the build options and a hash of the source. Any change makes a new key.
+*/
+std::string program_cache_key(const std::string& options, const std::string& source) {
+	char name[MAX_INFO_LENGTH] = "", driver[MAX_INFO_LENGTH] = "", version[MAX_INFO_LENGTH] = "";
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, nullptr);
+	clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, nullptr);
+	clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version), version, nullptr);
+
+	return std::string(name) + "|" + driver + "|" + version + "|" + options + "|" + hash_hex(source);
+}
+
+/*
+	The cache file of key: named after its hash, it starts with the key itself (one line)
+	to tell a hash collision from a hit, followed by the binary.
+*/
+std::string program_cache_path(const std::string& key) {
+	return std::string(PROGRAM_CACHE_DIR) + "/" + hash_hex(key) + ".bin";
+}
+
+/*
+	Creates program from the binary cached under key, and builds it. Returns false, with no
+	program, when there is no such binary or the runtime rejects it (e.g. after a driver
+	update that kept the version string).
+*/
+bool load_cached_program(const std::string& key, const std::string& options) {
+	std::ifstream file(program_cache_path(key), std::ifstream::in | std::ifstream::binary);
+	if (!file.is_open()) return false;
+
+	std::string cached_key;
+	std::getline(file, cached_key);
+	if (cached_key != key) return false;
+
+	std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (binary.empty()) return false;
+
+	const unsigned char* binaries[] = { binary.data() };
+	size_t size = binary.size();
+	cl_int err, binary_status = CL_SUCCESS;
+	program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &binary_status, &err);
+	if (err != CL_SUCCESS || binary_status != CL_SUCCESS) {
+		if (program) clReleaseProgram(program);
+		program = nullptr;
+		return false;
+	}
+
+	// a program created from a binary still has to be built, which is mostly a link.
+	err = clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		clReleaseProgram(program);
+		program = nullptr;
+		return false;
+	}
+	return true;
+}
+
+/*
+	Writes the binary of the built program to the cache under key. The binary is written
+	beside the cache file, then moved over it, so that a launch never loads a partial one.
+	A failure only costs the next launch a source build.
+*/
+void store_program_binary(const std::string& key) {
+	size_t size = 0;
+	cl_int err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr);
+	if (err != CL_SUCCESS || size == 0) return;
+
+	std::vector<unsigned char> binary(size);
+	unsigned char* binaries[] = { binary.data() };
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr);
+	if (err != CL_SUCCESS) return;
+
+#ifdef _WIN32
+	_mkdir(PROGRAM_CACHE_DIR);
+#else
+	mkdir(PROGRAM_CACHE_DIR, 0755);
+#endif
+	std::string path = program_cache_path(key), temporary = path + ".tmp";
+	std::ofstream file(temporary, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	file << key << '\n';
+	file.write((const char*)binary.data(), binary.size());
+	file.close();
+	if (!file || !replace_file(temporary.c_str(), path.c_str())) {
+		std::cout << "Failed to write the CL program cache in " << PROGRAM_CACHE_DIR << std::endl;
+		remove(temporary.c_str());
+	}
+}
+
+/*
+	Returns the build options defining the constants of the kernels from the host's
+	configuration, floats as literals that read back to the same value. Every distinct
+	configuration is a distinct program, with the constants folded by the compiler, and a
+	distinct entry of the program cache.
+*/
+std::string program_options() {
+	std::ostringstream options;
+	options << std::setprecision(9) << std::showpoint;
+	options << "-D NUM_POINTS=" << NUM_POINTS;
+	options << " -D GRAVITY=" << gravity << "f";
+	options << " -D RESTITUTION=" << restitution << "f";
+	options << " -D RESTING_SPEED=" << resting_speed << "f";
+	options << " -D MIN_RADIUS=" << MIN_RADIUS << "f";
+	return options.str();
+}
+
+/*
+	Creates and builds the OpenCL program of the CL kernels, from the source embedded in the
+	executable at build time (see kernel_sources.h).
+
+	The ball layout and the initial state shared with the host (ball_layout.h, ball_init.h) are
+	compiled ahead of the kernels, and the host's configuration is defined in the build options
+	(see program_options()).
+
+	Unless --no-program-cache, the program is first looked up in PROGRAM_CACHE_DIR, and one
+	built from source is stored there for the next launches: some runtimes (CPU ones
+	especially) take seconds to build it.
+
+	Runs on program_builder, alongside the main thread (see main()): it only sets program,
+	never the shared status.
+*/
+void create_program(cl_uint num_devices) {
+	std::string layout_s = (const char*)ball_layout_source;
+	std::string init_s = (const char*)ball_init_source;
+	std::string s = (const char*)kernel_source;
+	const char* sources[] = { layout_s.c_str(), init_s.c_str(), s.c_str() };
+
+	std::string options = program_options();
+	std::string key;
+	auto start = std::chrono::steady_clock::now();
+	if (program_cache) {
+		key = program_cache_key(options, layout_s + init_s + s);
+		if (load_cached_program(key, options)) {
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "CL program loaded from " << program_cache_path(key) << " in " << ms << " ms." << std::endl;
+			return;
+		}
+	}
+
+	cl_int err;
+	program = clCreateProgramWithSource(context, 3, sources, nullptr, &err);
+	if (err != CL_SUCCESS) {
+		std::cout << "Failed to create CL program from source." << std::endl;
+		program = nullptr;
+		return;
+	}
+
+	err = clBuildProgram(program, num_devices, &device, options.c_str(), nullptr, nullptr);
+	if (err != CL_SUCCESS) {
+		char log[DEBUG_LOG_BUFFER_SIZE];
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(log), log, nullptr);
+
+		std::cout << "Failed to build CL program." << std::endl;
+		std::cerr << log;
+		clReleaseProgram(program);
+		program = nullptr;
+		return;
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "CL program built from source in " << ms << " ms." << std::endl;
+	if (program_cache) store_program_binary(key);
+}
+
+/*
+	Compiles a GLSL shader of the given type from source. Returns 0 on failure.
+*/
+GLuint compile_shader(GLenum type, const char* source) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+
+	GLint compiled;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled) {
+		char log[DEBUG_LOG_BUFFER_SIZE];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+
+		std::cout << "Failed to compile GL shader." << std::endl;
+		std::cerr << log;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+/*
+	Looks up the extensions that let the GL/CL handoff of the shared vbos be done with sync
+	objects, on the devices, instead of the host waiting for GL or CL to finish:
+	- cl_khr_gl_event: CL waits on a GL fence behind the last draw before writing a vbo,
+	  instead of the host calling glFinish.
+	- GL_ARB_cl_event: GL waits on the CL event releasing a vbo before drawing it, instead of
+	  the host calling clWaitForEvents.
+	Either one falls back to the host wait when it is missing (or with --no-sync-objects).
+*/
+void create_sync_objects() {
+	if (!sync_objects) return;
+
+	char extensions[DEBUG_LOG_BUFFER_SIZE] = "";
+	clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, sizeof(extensions), extensions, nullptr);
+	if (std::string(extensions).find("cl_khr_gl_event") != std::string::npos && GLEW_ARB_sync) {
+		cl_platform_id platform;
+		clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+		create_event_from_gl_sync = (create_event_from_gl_sync_fn)clGetExtensionFunctionAddressForPlatform(platform, "clCreateEventFromGLsyncKHR");
+	}
+	gl_waits_cl = GLEW_ARB_cl_event && GLEW_ARB_sync;
+
+	std::cout << "CL waits for GL with " << (create_event_from_gl_sync ? "cl_khr_gl_event" : "glFinish")
+		<< ", GL waits for CL with " << (gl_waits_cl ? "GL_ARB_cl_event" : "clWaitForEvents") << "." << std::endl;
+}
+
+/*
+	Creates and links the GL program of the instanced or point rendering, and looks up its
+	attributes and uniforms.
+*/
+void create_circle_program() {
+	bool points = render_mode == render::points;
+	GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, points ? POINT_VERTEX_SHADER : CIRCLE_VERTEX_SHADER);
+	GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, points ? POINT_FRAGMENT_SHADER : CIRCLE_FRAGMENT_SHADER);
+	if (!vertex_shader || !fragment_shader) return;
+
+	circle_program = glCreateProgram();
+	glAttachShader(circle_program, vertex_shader);
+	glAttachShader(circle_program, fragment_shader);
+	glLinkProgram(circle_program);
+	// the program keeps them alive as long as it needs them.
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+
+	GLint linked;
+	glGetProgramiv(circle_program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		char log[DEBUG_LOG_BUFFER_SIZE];
+		glGetProgramInfoLog(circle_program, sizeof(log), nullptr, log);
+
+		std::cout << "Failed to link GL program." << std::endl;
+		std::cerr << log;
+		glDeleteProgram(circle_program);
+		circle_program = 0;
+		return;
+	}
+
+	// -1 for what the program does not use.
+	vertex_location = glGetAttribLocation(circle_program, "vertex");
+	instance_location = glGetAttribLocation(circle_program, "instance");
+	color_location = glGetAttribLocation(circle_program, "color");
+	pixels_per_unit_location = glGetUniformLocation(circle_program, "pixels_per_unit");
+}
+
+/*
+	Sets the ball field buffers as the first BALL_ARGS_COUNT arguments of kernel.
+*/
+cl_int set_ball_args(cl_kernel kernel) {
+	cl_int err = CL_SUCCESS;
+	cl_uint index = 0;
+#define SET_BALL_ARG(type, name) err |= clSetKernelArg(kernel, index++, sizeof(cl_mem), &d_##name);
+	BALL_FIELDS(SET_BALL_ARG)
+#undef SET_BALL_ARG
+	return err;
+}
+
+/*
+	Creates the prefix sum and radix sort kernels the broad-phases are built on.
+
+	Their arguments change from one call to the next, so they are set when the kernels are queued.
+*/
+cl_int create_scan_kernels() {
+	status = CL_SUCCESS;
+
+	scan_blocks = clCreateKernel(program, "scan_blocks", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	scan_add = clCreateKernel(program, "scan_add", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	radix_count = clCreateKernel(program, "radix_count", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	radix_scatter = clCreateKernel(program, "radix_scatter", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Creates the kernels of the uniform grid broad-phase.
+*/
+cl_int create_grid_kernels() {
+	status = CL_SUCCESS;
+
+	grid_count = clCreateKernel(program, "grid_count", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(grid_count);
+	status |= clSetKernelArg(grid_count, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_cell_ids);
+	status |= clSetKernelArg(grid_count, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_cell_starts);
+	status |= clSetKernelArg(grid_count, BALL_ARGS_COUNT + 2, sizeof(float), &cell_size);
+	status |= clSetKernelArg(grid_count, BALL_ARGS_COUNT + 3, sizeof(cl_uint), &grid_dim);
+	status |= clSetKernelArg(grid_count, BALL_ARGS_COUNT + 4, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	grid_scatter = clCreateKernel(program, "grid_scatter", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = clSetKernelArg(grid_scatter, 0, sizeof(cl_mem), &d_cell_ids);
+	status |= clSetKernelArg(grid_scatter, 1, sizeof(cl_mem), &d_cell_ends);
+	status |= clSetKernelArg(grid_scatter, 2, sizeof(cl_mem), &d_sorted);
+	status |= clSetKernelArg(grid_scatter, 3, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	grid_collide = clCreateKernel(program, "grid_collide", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(grid_collide);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_sorted);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_cell_ids);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_cell_starts);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_cell_ends);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 4, sizeof(cl_uint), &grid_dim);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 5, sizeof(float), &skin);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 6, sizeof(cl_mem), &d_neighbours);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 7, sizeof(cl_mem), &d_neighbour_counts);
+	status |= clSetKernelArg(grid_collide, BALL_ARGS_COUNT + 8, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Creates the kernels of the sort and sweep broad-phase.
+*/
+cl_int create_sap_kernels() {
+	status = CL_SUCCESS;
+
+	sap_keys = clCreateKernel(program, "sap_keys", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(sap_keys);
+	status |= clSetKernelArg(sap_keys, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_sort_keys[0]);
+	status |= clSetKernelArg(sap_keys, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_sort_values[0]);
+	status |= clSetKernelArg(sap_keys, BALL_ARGS_COUNT + 2, sizeof(float), &skin);
+	status |= clSetKernelArg(sap_keys, BALL_ARGS_COUNT + 3, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	sap_sweep = clCreateKernel(program, "sap_sweep", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(sap_sweep);
+	status |= clSetKernelArg(sap_sweep, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_sort_keys[0]);
+	status |= clSetKernelArg(sap_sweep, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_sort_values[0]);
+	status |= clSetKernelArg(sap_sweep, BALL_ARGS_COUNT + 2, sizeof(float), &skin);
+	status |= clSetKernelArg(sap_sweep, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_neighbours);
+	status |= clSetKernelArg(sap_sweep, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_neighbour_counts);
+	status |= clSetKernelArg(sap_sweep, BALL_ARGS_COUNT + 5, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Creates the kernels of the linear BVH broad-phase.
+*/
+cl_int create_bvh_kernels() {
+	status = CL_SUCCESS;
+
+	lbvh_morton = clCreateKernel(program, "lbvh_morton", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(lbvh_morton);
+	status |= clSetKernelArg(lbvh_morton, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_sort_keys[0]);
+	status |= clSetKernelArg(lbvh_morton, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_sort_values[0]);
+	status |= clSetKernelArg(lbvh_morton, BALL_ARGS_COUNT + 2, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	lbvh_build = clCreateKernel(program, "lbvh_build", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = clSetKernelArg(lbvh_build, 0, sizeof(cl_mem), &d_sort_keys[0]);
+	status |= clSetKernelArg(lbvh_build, 1, sizeof(cl_mem), &d_bvh_children);
+	status |= clSetKernelArg(lbvh_build, 2, sizeof(cl_mem), &d_bvh_parents);
+	status |= clSetKernelArg(lbvh_build, 3, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	lbvh_bounds = clCreateKernel(program, "lbvh_bounds", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(lbvh_bounds);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_sort_values[0]);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_bvh_children);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_bvh_parents);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_bvh_bounds);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_bvh_flags);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 5, sizeof(float), &skin);
+	status |= clSetKernelArg(lbvh_bounds, BALL_ARGS_COUNT + 6, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	lbvh_collide = clCreateKernel(program, "lbvh_collide", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(lbvh_collide);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_sort_values[0]);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_bvh_children);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_bvh_bounds);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 3, sizeof(float), &skin);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_neighbours);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 5, sizeof(cl_mem), &d_neighbour_counts);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 6, sizeof(cl_mem), &d_flags);
+	status |= clSetKernelArg(lbvh_collide, BALL_ARGS_COUNT + 7, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Creates the kernels of the neighbour lists.
+*/
+cl_int create_verlet_kernels() {
+	status = CL_SUCCESS;
+
+	verlet_check = clCreateKernel(program, "verlet_check", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(verlet_check);
+	status |= clSetKernelArg(verlet_check, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_build_centers);
+	status |= clSetKernelArg(verlet_check, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_flags);
+	status |= clSetKernelArg(verlet_check, BALL_ARGS_COUNT + 2, sizeof(float), &skin);
+	status |= clSetKernelArg(verlet_check, BALL_ARGS_COUNT + 3, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	verlet_snapshot = clCreateKernel(program, "verlet_snapshot", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(verlet_snapshot);
+	status |= clSetKernelArg(verlet_snapshot, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_build_centers);
+	status |= clSetKernelArg(verlet_snapshot, BALL_ARGS_COUNT + 1, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	verlet_collide = clCreateKernel(program, "verlet_collide", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(verlet_collide);
+	status |= clSetKernelArg(verlet_collide, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_neighbours);
+	status |= clSetKernelArg(verlet_collide, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_neighbour_counts);
+	status |= clSetKernelArg(verlet_collide, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_flags);
+	status |= clSetKernelArg(verlet_collide, BALL_ARGS_COUNT + 3, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Creates the kernels of the contact stage, for the colouring or the gather resolve.
+*/
+cl_int create_contact_kernels() {
+	status = CL_SUCCESS;
+	// the gather resolve needs every contact in the range of both its balls.
+	cl_uint both = resolve_mode == resolve::gather;
+
+	contact_count = clCreateKernel(program, "contact_count", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(contact_count);
+	status |= clSetKernelArg(contact_count, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_neighbours);
+	status |= clSetKernelArg(contact_count, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_neighbour_counts);
+	status |= clSetKernelArg(contact_count, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_contact_starts);
+	status |= clSetKernelArg(contact_count, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_flags);
+	status |= clSetKernelArg(contact_count, BALL_ARGS_COUNT + 4, sizeof(cl_uint), &both);
+	status |= clSetKernelArg(contact_count, BALL_ARGS_COUNT + 5, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	contact_write = clCreateKernel(program, "contact_write", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(contact_write);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_neighbours);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_neighbour_counts);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_contact_cursors);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_contacts);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_flags);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 5, sizeof(cl_uint), &both);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 6, sizeof(cl_uint), &contacts_capacity);
+	status |= clSetKernelArg(contact_write, BALL_ARGS_COUNT + 7, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	if (warm_starting) {
+		contact_warm_start = clCreateKernel(program, "contact_warm_start", &status);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to create kernel from program." << std::endl;
+			return status;
+		}
+
+		status = clSetKernelArg(contact_warm_start, 0, sizeof(cl_mem), &d_contacts);
+		status |= clSetKernelArg(contact_warm_start, 1, sizeof(cl_mem), &d_contact_starts);
+		status |= clSetKernelArg(contact_warm_start, 2, sizeof(cl_mem), &d_prev_contacts);
+		status |= clSetKernelArg(contact_warm_start, 3, sizeof(cl_mem), &d_prev_starts);
+		status |= clSetKernelArg(contact_warm_start, 4, sizeof(cl_mem), &d_prev_impulses);
+		status |= clSetKernelArg(contact_warm_start, 5, sizeof(cl_mem), &d_impulses);
+		status |= clSetKernelArg(contact_warm_start, 6, sizeof(cl_uint), &contacts_capacity);
+		status |= clSetKernelArg(contact_warm_start, 7, sizeof(unsigned int), &balls_count);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to set kernel args." << std::endl;
+			return status;
+		}
+	}
+
+	if (resolve_mode == resolve::gather) {
+		gather_prepare = clCreateKernel(program, "gather_prepare", &status);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to create kernel from program." << std::endl;
+			return status;
+		}
+
+		status = set_ball_args(gather_prepare);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_contacts);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_contact_starts);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_impulses);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_biases);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_resolved_center);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 5, sizeof(cl_mem), &d_resolved_velocity);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 6, sizeof(cl_uint), &contacts_capacity);
+		status |= clSetKernelArg(gather_prepare, BALL_ARGS_COUNT + 7, sizeof(unsigned int), &balls_count);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to set kernel args." << std::endl;
+			return status;
+		}
+
+		gather_resolve = clCreateKernel(program, "gather_resolve", &status);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to create kernel from program." << std::endl;
+			return status;
+		}
+
+		status = set_ball_args(gather_resolve);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_contacts);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_contact_starts);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_impulses);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_biases);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_resolved_center);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 5, sizeof(cl_mem), &d_resolved_velocity);
+		// the stage (arg BALL_ARGS_COUNT + 6) is set for every pass.
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 7, sizeof(cl_uint), &contacts_capacity);
+		status |= clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 8, sizeof(unsigned int), &balls_count);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to set kernel args." << std::endl;
+			return status;
+		}
+
+		return status;
+	}
+
+	colour_claim = clCreateKernel(program, "colour_claim", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = clSetKernelArg(colour_claim, 0, sizeof(cl_mem), &d_contacts);
+	status |= clSetKernelArg(colour_claim, 1, sizeof(cl_mem), &d_contact_starts);
+	status |= clSetKernelArg(colour_claim, 2, sizeof(cl_mem), &d_contact_colours);
+	status |= clSetKernelArg(colour_claim, 3, sizeof(cl_mem), &d_claims);
+	status |= clSetKernelArg(colour_claim, 5, sizeof(cl_uint), &contacts_capacity);
+	status |= clSetKernelArg(colour_claim, 6, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	colour_resolve = clCreateKernel(program, "colour_resolve", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	// the colour (arg BALL_ARGS_COUNT + 7) is set for every round.
+	status = set_ball_args(colour_resolve);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_contacts);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_contact_starts);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_contact_colours);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_claims);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_impulses);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 5, sizeof(cl_mem), &d_biases);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 6, sizeof(cl_mem), &d_flags);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 8, sizeof(cl_uint), &contacts_capacity);
+	status |= clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 9, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	colour_solve = clCreateKernel(program, "colour_solve", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	// the colour and stage (args BALL_ARGS_COUNT + 5 and 6) are set for every batch.
+	status = set_ball_args(colour_solve);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_contacts);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 1, sizeof(cl_mem), &d_contact_starts);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_contact_colours);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_impulses);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 4, sizeof(cl_mem), &d_biases);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 7, sizeof(cl_uint), &contacts_capacity);
+	status |= clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 8, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Creates all the OpenCL kernels to be used in the OpenCL program.
+
+	Also sets the kernel arguments.
+*/
+cl_int create_kernels() {
+	status = CL_SUCCESS;
+
+	init_balls = clCreateKernel(program, "init_balls", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	cl_uint seed_lo = (cl_uint)seed, seed_hi = (cl_uint)(seed >> 32);
+	status = set_ball_args(init_balls);
+	status |= clSetKernelArg(init_balls, BALL_ARGS_COUNT + 0, sizeof(cl_uint), &seed_lo);
+	status |= clSetKernelArg(init_balls, BALL_ARGS_COUNT + 1, sizeof(cl_uint), &seed_hi);
+	status |= clSetKernelArg(init_balls, BALL_ARGS_COUNT + 2, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	// their arguments are set by place_on_lattice(), which makes their buffer.
+	bool lattice = placement_mode == placement::lattice && !restored.data;
+	if (lattice) {
+		lattice_classes = clCreateKernel(program, "lattice_classes", &status);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to create kernel from program." << std::endl;
+			return status;
+		}
+
+		lattice_place = clCreateKernel(program, "lattice_place", &status);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to create kernel from program." << std::endl;
+			return status;
+		}
+	}
+
+	wall_bounce = clCreateKernel(program, "wall_bounce", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(wall_bounce);
+	status |= clSetKernelArg(wall_bounce, BALL_ARGS_COUNT + 0, sizeof(float), &step_t);
+	status |= clSetKernelArg(wall_bounce, BALL_ARGS_COUNT + 1, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	ball_bounce = clCreateKernel(program, "ball_bounce", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(ball_bounce);
+	status |= clSetKernelArg(ball_bounce, BALL_ARGS_COUNT + 0, sizeof(unsigned int), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	if (broadphase_mode != broadphase::brute_force || lattice) {
+		status = create_scan_kernels();
+		if (status != CL_SUCCESS) return status;
+	}
+
+	if (broadphase_mode == broadphase::uniform_grid) {
+		status = create_grid_kernels();
+		if (status != CL_SUCCESS) return status;
+	}
+	else if (broadphase_mode == broadphase::sort_and_sweep) {
+		status = create_sap_kernels();
+		if (status != CL_SUCCESS) return status;
+	}
+	else if (broadphase_mode == broadphase::linear_bvh) {
+		status = create_bvh_kernels();
+		if (status != CL_SUCCESS) return status;
+	}
+
+	if (neighbour_lists) {
+		status = create_verlet_kernels();
+		if (status != CL_SUCCESS) return status;
+	}
+
+	if (resolve_mode != resolve::direct) {
+		status = create_contact_kernels();
+		if (status != CL_SUCCESS) return status;
+	}
+
+	// headless, nothing is drawn.
+	if (headless) return status;
+
+	if (render_mode != render::polygons) {
+		update_instances = clCreateKernel(program, "update_instances", &status);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to create kernel from program." << std::endl;
+			return status;
+		}
+
+		status = set_ball_args(update_instances);
+		// the vbo written is set every frame (see update()).
+		status |= clSetKernelArg(update_instances, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_vbos[0]);
+		status |= clSetKernelArg(update_instances, BALL_ARGS_COUNT + 1, sizeof(unsigned int), &balls_count);
+		if (status != CL_SUCCESS) {
+			std::cout << "Failed to set kernel args." << std::endl;
+			return status;
+		}
+
+		return status;
+	}
+
+	update_vbo = clCreateKernel(program, "update_vbo", &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to create kernel from program." << std::endl;
+		return status;
+	}
+
+	status = set_ball_args(update_vbo);
+	// the vbo written is set every frame (see update()).
+	status |= clSetKernelArg(update_vbo, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_vbos[0]);
+	status |= clSetKernelArg(update_vbo, BALL_ARGS_COUNT + 1, sizeof(unsigned int), &balls_count);
+	status |= clSetKernelArg(update_vbo, BALL_ARGS_COUNT + 2, sizeof(cl_mem), &d_circle);
+	status |= clSetKernelArg(update_vbo, BALL_ARGS_COUNT + 3, sizeof(cl_mem), &d_lod_steps);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		return status;
+	}
+
+	return status;
+}
+
+/*
+	Initializes the display and reads the arguments (the balls are made by make_balls() or
+	create_balls_on_device()).
+
+	Usage: Project [ball count] [--broadphase brute|grid|sap|lbvh] [--skin distance] [--resolve direct|colour|gather]
+	               [--iterations count] [--no-warm-start] [--substeps count] [--render polygons|instanced|points]
+	               [--no-lod] [--vbos count] [--no-sync-objects] [--profile] [--check-momentum]
+	               [--headless [--steps count]] [--platform number] [--device number]
+	               [--backend opencl|cpu] [--threads count] [--simd scalar|avx2|avx512]
+	               [--no-program-cache] [--gravity acceleration] [--restitution coefficient] [--seed number]
+	               [--placement random|lattice] [--checkpoint file [--checkpoint-every steps]] [--restore file]
+*/
+void init(int argc, char** argv) {
+	//////////////////////////init display//////////////////////////
+	// headless, there is no display to open (and GLUT may have nothing to connect to).
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--headless") headless = true;
+	}
+
+	if (!headless) {
+		glutInit(&argc, argv);
+		glutInitWindowPosition(-1, -1);
+		glutInitWindowSize(WWIDTH, WHEIGHT);
+		glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_ALPHA);
+		glutCreateWindow("Bouncing Balls Simulation");
+		glewInit();
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glEnable(GL_BLEND);
+		glutDisplayFunc(update);
+		glutIdleFunc(update);
+	}
+	////////////////////////////////////////////////////////////////
+
+	///////////////////////////init args////////////////////////////
+	// glutInit has already removed the arguments meant for GLUT.
+	balls_count = BALL_COUNT;
+	bool simd_requested = false;
+	// the option being read, for when its number does not parse.
+	int i = 1;
+	try {
+		for (i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+
+			if (arg == "--broadphase" && i + 1 < argc) {
+				std::string mode = argv[++i];
+				if (mode == "brute") broadphase_mode = broadphase::brute_force;
+				else if (mode == "grid") broadphase_mode = broadphase::uniform_grid;
+				else if (mode == "sap") broadphase_mode = broadphase::sort_and_sweep;
+				else if (mode == "lbvh") broadphase_mode = broadphase::linear_bvh;
+				else {
+					std::cout << "Unknown broad-phase " << mode << " (expected brute, grid, sap or lbvh)." << std::endl;
+					std::exit(1);
+				}
+			}
+			else if (arg == "--skin" && i + 1 < argc) {
+				skin = std::stof(argv[++i]);
+			}
+			else if (arg == "--resolve" && i + 1 < argc) {
+				std::string mode = argv[++i];
+				if (mode == "direct") resolve_mode = resolve::direct;
+				else if (mode == "colour") resolve_mode = resolve::colour;
+				else if (mode == "gather") resolve_mode = resolve::gather;
+				else {
+					std::cout << "Unknown resolve mode " << mode << " (expected direct, colour or gather)." << std::endl;
+					std::exit(1);
+				}
+			}
+			else if (arg == "--iterations" && i + 1 < argc) {
+				solver_iterations = std::stoi(argv[++i]);
+			}
+			else if (arg == "--no-warm-start") {
+				warm_starting = false;
+			}
+			else if (arg == "--substeps" && i + 1 < argc) {
+				substeps = std::stoi(argv[++i]);
+			}
+			else if (arg == "--gravity" && i + 1 < argc) {
+				gravity = std::stof(argv[++i]);
+			}
+			else if (arg == "--restitution" && i + 1 < argc) {
+				restitution = std::stof(argv[++i]);
+			}
+			else if (arg == "--render" && i + 1 < argc) {
+				std::string mode = argv[++i];
+				if (mode == "polygons") render_mode = render::polygons;
+				else if (mode == "instanced") render_mode = render::instanced;
+				else if (mode == "points") render_mode = render::points;
+				else {
+					std::cout << "Unknown render mode " << mode << " (expected polygons, instanced or points)." << std::endl;
+					std::exit(1);
+				}
+			}
+			else if (arg == "--no-lod") {
+				lod = false;
+			}
+			else if (arg == "--vbos" && i + 1 < argc) {
+				shared_vbos = std::stoi(argv[++i]);
+			}
+			else if (arg == "--no-sync-objects") {
+				sync_objects = false;
+			}
+			else if (arg == "--no-program-cache") {
+				program_cache = false;
+			}
+			else if (arg == "--headless") {
+				// already seen above.
+			}
+			else if (arg == "--steps" && i + 1 < argc) {
+				headless_steps = std::stoll(argv[++i]);
+			}
+			else if (arg == "--platform" && i + 1 < argc) {
+				platform_choice = std::stoi(argv[++i]);
+			}
+			else if (arg == "--device" && i + 1 < argc) {
+				device_choice = std::stoi(argv[++i]);
+			}
+			else if (arg == "--backend" && i + 1 < argc) {
+				std::string mode = argv[++i];
+				if (mode == "opencl") backend_mode = backend::opencl;
+				else if (mode == "cpu") backend_mode = backend::cpu;
+				else {
+					std::cout << "Unknown backend " << mode << " (expected opencl or cpu)." << std::endl;
+					std::exit(1);
+				}
+			}
+			else if (arg == "--threads" && i + 1 < argc) {
+				cpu_threads = std::stoi(argv[++i]);
+			}
+			else if (arg == "--simd" && i + 1 < argc) {
+				std::string mode = argv[++i];
+				if (mode == "scalar") simd_mode = simd::scalar;
+				else if (mode == "avx2") simd_mode = simd::avx2;
+				else if (mode == "avx512") simd_mode = simd::avx512;
+				else {
+					std::cout << "Unknown instruction set " << mode << " (expected scalar, avx2 or avx512)." << std::endl;
+					std::exit(1);
+				}
+				simd_requested = true;
+			}
+			else if (arg == "--profile") {
+				profiling = true;
+			}
+			else if (arg == "--check-momentum") {
+				check_momentum = true;
+			}
+			else if (arg == "--seed" && i + 1 < argc) {
+				seed = std::stoull(argv[++i]);
+				seed_requested = true;
+			}
+			else if (arg == "--checkpoint" && i + 1 < argc) {
+				checkpoint_path = argv[++i];
+			}
+			else if (arg == "--checkpoint-every" && i + 1 < argc) {
+				checkpoint_every = std::stoll(argv[++i]);
+			}
+			else if (arg == "--restore" && i + 1 < argc) {
+				restore_path = argv[++i];
+			}
+			else if (arg == "--placement" && i + 1 < argc) {
+				std::string mode = argv[++i];
+				if (mode == "random") placement_mode = placement::random;
+				else if (mode == "lattice") placement_mode = placement::lattice;
+				else {
+					std::cout << "Unknown placement " << mode << " (expected random or lattice)." << std::endl;
+					std::exit(1);
+				}
+				placement_requested = true;
+			}
+			else if (arg.size() > 1 && arg[0] == '-') {
+				std::cout << "Unknown option " << arg << ", or it is missing its value." << std::endl;
+				std::exit(1);
+			}
+			else {
+				size_t digits = 0;
+				long long count = std::stoll(arg, &digits);
+				if (digits != arg.size() || count < 1) {
+					std::cout << "The ball count is a number of at least 1, not " << arg << "." << std::endl;
+					std::exit(1);
+				}
+				balls_count = (size_t)count;
+			}
+		}
+	}
+	catch (const std::exception&) {
+		std::cout << "Invalid number " << argv[std::min(i, argc - 1)] << "." << std::endl;
+		std::exit(1);
+	}
+
+	// the checkpoint's scene and configuration replace the arguments'.
+	if (!restore_path.empty()) restore_checkpoint();
+
+	if (checkpoint_every < 0 || (checkpoint_every == 0 && !checkpoint_path.empty() && !headless)) {
+		std::cout << "In a window, --checkpoint needs a positive --checkpoint-every." << std::endl;
+		std::exit(1);
+	}
+
+	if (solver_iterations < 1 || (solver_iterations > 1 && resolve_mode == resolve::direct)) {
+		std::cout << "The solver runs at least one iteration, and more only with --resolve colour|gather." << std::endl;
+		std::exit(1);
+	}
+
+	if (substeps < 1) {
+		std::cout << "The simulation runs at least one step per frame." << std::endl;
+		std::exit(1);
+	}
+	if (restitution < 0.f || restitution > 1.f) {
+		std::cout << "The restitution is between 0 and 1." << std::endl;
+		std::exit(1);
+	}
+	step_t = UPDATE_FREQ / substeps;
+
+	if (shared_vbos < 1 || shared_vbos > MAX_SHARED_VBOS) {
+		std::cout << "The balls are drawn from 1 to " << MAX_SHARED_VBOS << " shared VBOs." << std::endl;
+		std::exit(1);
+	}
+
+	// the contact stage works on the neighbour lists, rebuilt every frame when there is no skin.
+	neighbour_lists = skin > 0 || resolve_mode != resolve::direct;
+	if (neighbour_lists && broadphase_mode == broadphase::brute_force) {
+		std::cout << "Neighbour lists (--skin) and --resolve colour|gather need the grid, sap or lbvh broad-phase." << std::endl;
+		std::exit(1);
+	}
+
+	if (backend_mode == backend::cpu) {
+		if (!simd_requested) simd_mode = detect_simd();
+		else if (simd_mode > detect_simd()) {
+			std::cout << "This CPU does not support the requested instruction set." << std::endl;
+			std::exit(1);
+		}
+		if (cpu_threads == 0) cpu_threads = std::max(std::thread::hardware_concurrency(), 1u);
+		if (broadphase_mode != broadphase::brute_force && broadphase_mode != broadphase::uniform_grid) {
+			std::cout << "The CPU backend has the brute and grid broad-phases only." << std::endl;
+			std::exit(1);
+		}
+		if (check_momentum) {
+			std::cout << "The CPU backend has no --check-momentum." << std::endl;
+			std::exit(1);
+		}
+
+		const char* simd_names[] = { "scalar", "AVX2", "AVX-512" };
+		std::cout << "CPU backend: " << cpu_threads << " thread(s), " << simd_names[(int)simd_mode] << ", "
+			<< (broadphase_mode == broadphase::uniform_grid ? "uniform grid" : "every pair tested")
+			<< " (the skin and resolve options are for the OpenCL backend)." << std::endl << std::endl;
+	}
+
+	if (headless && headless_steps < 1) {
+		std::cout << "The headless run takes at least one step." << std::endl;
+		std::exit(1);
+	}
+	// every kernel is timed in the headless report.
+	if (headless) profiling = true;
+
+	// ball_bounce decodes its pair from its work-item id, one work-item per unique pair.
+	pairs_count = balls_count * (balls_count - 1) / 2;
+
+	if (!seed_requested) {
+		std::random_device rd;
+		seed = ((unsigned long long)rd() << 32) | rd();
+	}
+	if (!restored.data) std::cout << "Seed: " << seed << " (--seed to make the same balls again)" << std::endl << std::endl;
+
+	// instanced arrays and draws are core since OpenGL 3.3.
+	if (!headless && render_mode == render::instanced && !GLEW_VERSION_3_3) {
+		std::cout << "Instanced rendering needs OpenGL 3.3, drawing the balls as polygons instead." << std::endl;
+		render_mode = render::polygons;
+	}
+	// shaders and point sprites are core since OpenGL 2.0.
+	if (!headless && render_mode == render::points && !GLEW_VERSION_2_0) {
+		std::cout << "Point rendering needs OpenGL 2.0, drawing the balls as polygons instead." << std::endl;
+		render_mode = render::polygons;
+	}
+	////////////////////////////////////////////////////////////////
+}
+
+/*
+	Maps the checkpoint at restore_path and takes its scene and configuration: the balls are
+	then made from the mapping (see make_balls() and create_balls_on_device()). Exits on a
+	file that is not a checkpoint of this version, or does not hold all its balls.
+*/
+void restore_checkpoint() {
+	if (!map_file(restore_path.c_str(), restored)) {
+		std::cout << "Failed to open checkpoint " << restore_path << std::endl;
+		std::exit(1);
+	}
+
+	const checkpoint_header* header = (const checkpoint_header*)restored.data;
+	bool valid = restored.size >= sizeof(checkpoint_header) && memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == CHECKPOINT_VERSION && header->header_size == sizeof(checkpoint_header);
+
+	int field = 0;
+#define CHECK_RESTORED_FIELD(type, name) \
+	valid = valid && header->field_sizes[field] == sizeof(cl_##type) && header->field_offsets[field] % CHECKPOINT_ALIGNMENT == 0 \
+		&& header->field_offsets[field] <= restored.size \
+		&& header->balls_count <= (restored.size - header->field_offsets[field]) / sizeof(cl_##type); \
+	++field;
+	BALL_FIELDS(CHECK_RESTORED_FIELD)
+#undef CHECK_RESTORED_FIELD
+	if (!valid || header->fields_count != (uint32_t)field || header->balls_count < 1) {
+		std::cout << restore_path << " is not a version " << CHECKPOINT_VERSION << " checkpoint, or is truncated." << std::endl;
+		std::exit(1);
+	}
+	// the radii and the vertices of the balls are built in, not read from the checkpoint.
+	if (header->min_radius != MIN_RADIUS || header->num_points != NUM_POINTS) {
+		std::cout << restore_path << " was saved with MIN_RADIUS " << header->min_radius << " and NUM_POINTS " << header->num_points
+			<< ", this build has " << MIN_RADIUS << " and " << NUM_POINTS << "." << std::endl;
+		std::exit(1);
+	}
+
+	balls_count = (size_t)header->balls_count;
+	seed = header->seed;
+	simulated_steps = header->steps;
+	substeps = header->substeps;
+	gravity = header->gravity;
+	restitution = header->restitution;
+	resting_speed = header->resting_speed;
+	std::cout << "Restored " << balls_count << " balls at step " << simulated_steps << " from " << restore_path
+		<< " (seed " << seed << ")." << std::endl << std::endl;
+}
+
+/*
+	Writes every ball and the configuration to checkpoint_path (see checkpoint.h), through a
+	temporary file so that a checkpoint is never left half written.
+
+	The balls come from the device, or from the CPU engine, blocking until they are read. If
+	any of them cannot be read or written, nothing is saved and the previous checkpoint stays.
+*/
+void save_checkpoint() {
+	checkpoint_header header = {};
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.header_size = sizeof(checkpoint_header);
+	header.balls_count = balls_count;
+	header.seed = seed;
+	header.steps = simulated_steps;
+	header.step_t = step_t;
+	header.substeps = substeps;
+	header.gravity = gravity;
+	header.restitution = restitution;
+	header.resting_speed = resting_speed;
+	header.min_radius = MIN_RADIUS;
+	header.num_points = NUM_POINTS;
+
+	uint64_t offset = checkpoint_align(sizeof(header));
+	int field = 0;
+#define LAY_OUT_FIELD(type, name) \
+	header.field_offsets[field] = offset; \
+	header.field_sizes[field++] = sizeof(cl_##type); \
+	offset = checkpoint_align(offset + balls_count * sizeof(cl_##type));
+	BALL_FIELDS(LAY_OUT_FIELD)
+#undef LAY_OUT_FIELD
+	header.fields_count = field;
+
+	// the host copy of the fields the CPU engine moves is refreshed, the others never change.
+	if (backend_mode == backend::cpu && !cpu_read_balls((float*)balls.center.data(), (float*)balls.velocity.data())) {
+		std::cout << "Failed to read the balls back for checkpoint " << checkpoint_path << std::endl;
+		return;
+	}
+
+	std::string temporary = checkpoint_path + ".tmp";
+	std::ofstream file(temporary, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	file.write((const char*)&header, sizeof(header));
+
+	std::vector<char> padding(CHECKPOINT_ALIGNMENT, 0), data;
+	cl_int read_status = CL_SUCCESS;
+	field = 0;
+#define WRITE_FIELD(type, name) \
+	if (read_status == CL_SUCCESS) { \
+		size_t bytes = balls_count * sizeof(cl_##type); \
+		const char* source = (const char*)balls.name.data(); \
+		if (backend_mode == backend::opencl) { \
+			data.resize(bytes); \
+			read_status = clEnqueueReadBuffer(cmd_q, d_##name, CL_TRUE, 0, bytes, data.data(), 0, nullptr, nullptr); \
+			source = data.data(); \
+		} \
+		file.write(padding.data(), (std::streamsize)(header.field_offsets[field++] - file.tellp())); \
+		file.write(source, bytes); \
+	}
+	BALL_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+
+	file.close();
+	if (read_status != CL_SUCCESS) {
+		std::cout << "Failed to read the balls back for checkpoint " << checkpoint_path << std::endl;
+		remove(temporary.c_str());
+		return;
+	}
+	if (!file) {
+		std::cout << "Failed to write checkpoint " << temporary << std::endl;
+		remove(temporary.c_str());
+		return;
+	}
+	// the previous checkpoint stays whole until the new one is on disk and takes its place.
+	if (!replace_file(temporary.c_str(), checkpoint_path.c_str())) {
+		std::cout << "Failed to replace checkpoint " << checkpoint_path << std::endl;
+		remove(temporary.c_str());
+		return;
+	}
+	saved_steps = simulated_steps;
+}
+
+/*
+	Counts a step of the simulation, saving a checkpoint every checkpoint_every steps.
+*/
+void step_done() {
+	++simulated_steps;
+	if (backend_mode == backend::opencl && simulated_steps % PROFILE_FRAMES == 0) check_overflows();
+	if (checkpoint_every > 0 && simulated_steps % checkpoint_every == 0) save_checkpoint();
+}
+
+/*
+	Colours every ball after its radius class, from the radii on the host.
+*/
+void color_balls() {
+	colors.resize(balls_count);
+	for (size_t i = 0; i < balls_count; ++i) {
+		int radius_class = (int)(balls.radius[i] / MIN_RADIUS + 0.5f);
+		if (radius_class == 1) colors[i] = { 0.5f, 1.f, 0.5f };
+		else if (radius_class == 2) colors[i] = { 0.5f, 0.5f, 1.f };
+		else colors[i] = { 1.f, 0.5f, 0.5f };
+	}
+}
+
+/*
+	Lays out the lattice for counts[c] balls of every radius class c. Returns the height the
+	rows of the lattice take, the layout only fits when it is no more than the box's.
+
+	The lattice has a band of rows per radius class, from the floor up, largest first, and
+	the squares of a band are as wide as its balls: small balls are not spaced out as widely
+	as the largest, plus LATTICE_GAP. The height the bands leave spare is shared by every row.
+*/
+float lay_out_lattice(const size_t counts[RADIUS_CLASSES], lattice_layout& layout) {
+	size_t rows[RADIUS_CLASSES], total_rows = 0;
+	float height = 0.f;
+	for (int c = 0; c < RADIUS_CLASSES; ++c) {
+		float spacing = 2 * MIN_RADIUS * (c + 1) + LATTICE_GAP;
+		layout.per_row[c] = (cl_uint)(2.f / spacing);
+		rows[c] = (counts[c] + layout.per_row[c] - 1) / layout.per_row[c];
+		total_rows += rows[c];
+		height += rows[c] * spacing;
+	}
+	if (height > 2.f) return height;
+
+	float spare = (2.f - height) / total_rows;
+	float bottom = -1.f;
+	for (int c = RADIUS_CLASSES - 1; c >= 0; --c) {
+		float radius = MIN_RADIUS * (c + 1);
+		layout.squares[c] = (cl_uint)(rows[c] * layout.per_row[c]);
+		layout.counts[c] = (cl_uint)counts[c];
+		layout.width[c] = 2.f / layout.per_row[c];
+		layout.row_height[c] = 2 * radius + LATTICE_GAP + spare;
+		layout.bottom[c] = bottom;
+		layout.jitter_x[c] = std::max(0.5f * (layout.width[c] - LATTICE_GAP) - radius, 0.f);
+		layout.jitter_y[c] = std::max(0.5f * (layout.row_height[c] - LATTICE_GAP) - radius, 0.f);
+		bottom += rows[c] * layout.row_height[c];
+	}
+	return height;
+}
+
+/*
+	Lays out the lattice for counts (see lay_out_lattice()) and returns whether it fits. A
+	lattice that does not fit is an error when --placement asked for it, otherwise the balls
+	stay where make_ball() put them.
+*/
+bool fit_lattice(const size_t counts[RADIUS_CLASSES], lattice_layout& layout) {
+	float height = lay_out_lattice(counts, layout);
+	if (height <= 2.f) return true;
+
+	std::cout << "The rows of the lattice would be " << height << " high, in a box 2 high";
+	if (placement_requested) {
+		std::cout << " (--placement random places the balls anyway)." << std::endl;
+		std::exit(1);
+	}
+	std::cout << ", placing the balls at random instead." << std::endl << std::endl;
+	placement_mode = placement::random;
+	return false;
+}
+
+/*
+	Makes the balls of the seed's scene on the host, for the CPU backend (see make_ball()), or
+	copies them from the restored checkpoint.
+*/
+void make_balls() {
+#define BALL_HOST_RESIZE(type, name) balls.name.resize(balls_count);
+	BALL_FIELDS(BALL_HOST_RESIZE)
+#undef BALL_HOST_RESIZE
+
+	if (restored.data) {
+		const checkpoint_header* header = (const checkpoint_header*)restored.data;
+		int field = 0;
+#define COPY_RESTORED_FIELD(type, name) \
+		memcpy(balls.name.data(), restored.data + header->field_offsets[field++], balls_count * sizeof(cl_##type));
+		BALL_FIELDS(COPY_RESTORED_FIELD)
+#undef COPY_RESTORED_FIELD
+		unmap_file(restored);
+		if (!headless) color_balls();
+		return;
+	}
+
+	cl_uint seed_lo = (cl_uint)seed, seed_hi = (cl_uint)(seed >> 32);
+	for (size_t i = 0; i < balls_count; ++i) {
+		make_ball(seed_lo, seed_hi, (cl_uint)i, balls.center[i].s, balls.velocity[i].s, &balls.radius[i], &balls.inv_mass[i]);
+	}
+
+	// the same lattice as place_on_lattice() makes on the device, ranking the balls in one pass.
+	if (placement_mode == placement::lattice) {
+		size_t counts[RADIUS_CLASSES] = {};
+		std::vector<cl_uint> ranks(balls_count);
+		for (size_t i = 0; i < balls_count; ++i) ranks[i] = (cl_uint)counts[lattice_class(balls.radius[i])]++;
+
+		lattice_layout layout;
+		if (fit_lattice(counts, layout)) {
+			for (size_t i = 0; i < balls_count; ++i) {
+				lattice_center(seed_lo, seed_hi, (cl_uint)i, lattice_class(balls.radius[i]), ranks[i], &layout, balls.center[i].s);
+			}
+		}
+	}
+
+	if (!headless) color_balls();
+}
+
+/*
+	Makes the balls of the seed's scene straight in device memory with init_balls, then moves
+	them onto the lattice with place_on_lattice(), so that nothing is generated serially nor
+	uploaded, or uploads them from the restored checkpoint as mapped. Then reads back only what
+	the host needs of them: the radii when drawing (level of detail and colours), the inverse
+	masses with --check-momentum.
+*/
+cl_int create_balls_on_device() {
+	if (restored.data) {
+		const checkpoint_header* header = (const checkpoint_header*)restored.data;
+		int field = 0;
+		status = CL_SUCCESS;
+#define UPLOAD_RESTORED_FIELD(type, name) \
+		status |= clEnqueueWriteBuffer(cmd_q, d_##name, CL_FALSE, 0, balls_count * sizeof(cl_##type), \
+			restored.data + header->field_offsets[field++], 0, nullptr, nullptr);
+		BALL_FIELDS(UPLOAD_RESTORED_FIELD)
+#undef UPLOAD_RESTORED_FIELD
+		// the uploads read the mapping until they are done.
+		clFinish(cmd_q);
+		unmap_file(restored);
+	}
+	else {
+		size_t global_size = balls_count;
+		status = clEnqueueNDRangeKernel(cmd_q, init_balls, 1, nullptr, &global_size, nullptr, 0, nullptr, nullptr);
+		if (status == CL_SUCCESS && placement_mode == placement::lattice) status = place_on_lattice();
+	}
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to make the balls on device." << std::endl;
+		return status;
+	}
+
+	if (!headless) {
+		balls.radius.resize(balls_count);
+		status = clEnqueueReadBuffer(cmd_q, d_radius, CL_TRUE, 0, balls_count * sizeof(cl_float), balls.radius.data(), 0, nullptr, nullptr);
+		if (status != CL_SUCCESS) return status;
+		color_balls();
+	}
+	if (check_momentum) {
+		balls.inv_mass.resize(balls_count);
+		status = clEnqueueReadBuffer(cmd_q, d_inv_mass, CL_TRUE, 0, balls_count * sizeof(cl_float), balls.inv_mass.data(), 0, nullptr, nullptr);
+	}
+	return clFinish(cmd_q);
+}
+
+/*
+	Queues kernel over global_size work-items.
+
+	When profiling, the kernel's execution time is added to its running total once the
+	frame is done (see collect_profiling()).
+*/
+void enqueue_kernel(cl_kernel kernel, size_t global_size) {
+	cl_event event = nullptr;
+	clEnqueueNDRangeKernel(cmd_q, kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, profiling ? &event : nullptr);
+	if (event) {
+		profiled_events.push_back({ kernel, event });
+		profiled_sizes.push_back(global_size);
+	}
+}
+
+/*
+	Adds the execution times of the kernels queued since the last call to their running totals.
+
+	Must be called once the queue is finished.
+*/
+void accumulate_profiling() {
+	char name[MAX_INFO_LENGTH];
+
+	for (size_t i = 0; i < profiled_events.size(); ++i) {
+		auto& profiled = profiled_events[i];
+		cl_ulong start, end;
+		clGetEventProfilingInfo(profiled.second, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+		clGetEventProfilingInfo(profiled.second, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+		clGetKernelInfo(profiled.first, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, nullptr);
+
+		kernel_times[name] += (end - start) * 1e-6;
+		kernel_items[name] += profiled_sizes[i];
+		clReleaseEvent(profiled.second);
+	}
+	profiled_events.clear();
+	profiled_sizes.clear();
+}
+
+/*
+	Prints the average time of every kernel per frame (or per step, headless) over the given
+	number of them, and starts over. Kernels listed in kernel_traffic also get their effective
+	bandwidth: the bytes they had to move over the time they took.
+*/
+void print_profiling(long long frames) {
+	const char* unit = headless ? "step" : "frame";
+	double total = 0;
+	std::cout << "Average kernel time per " << unit << " over " << frames << " " << unit << "s (ms):" << std::endl;
+	for (auto& kernel_time : kernel_times) {
+		std::cout << "  " << kernel_time.first << ":\t" << kernel_time.second / frames;
+
+		auto traffic = kernel_traffic.find(kernel_time.first);
+		if (traffic != kernel_traffic.end() && kernel_time.second > 0) {
+			// bytes per ms -> GB/s.
+			double bytes = (double)traffic->second * kernel_items[kernel_time.first];
+			std::cout << "\t(" << bytes / kernel_time.second * 1e-6 << " GB/s)";
+		}
+		std::cout << std::endl;
+		total += kernel_time.second;
+	}
+	std::cout << "  total:\t" << total / frames << std::endl;
+	if (!headless) {
+		if (backend_mode == backend::opencl) std::cout << "Host time in the GL/CL handoff per frame (ms): " << host_wait_time / frames << std::endl;
+		if (render_mode == render::polygons) std::cout << "Vertices per ball: " << NUM_POINTS << std::endl;
+	}
+	if (skin > 0) std::cout << "Neighbour list rebuilds: " << list_rebuilds << std::endl;
+	if (backend_mode == backend::cpu) std::cout << "Ranges stolen between threads: " << cpu_steals() - reported_steals << std::endl;
+	if (resolve_mode == resolve::colour) std::cout << "Most colours in a frame: " << max_colour_rounds << std::endl;
+	std::cout << std::endl;
+
+	kernel_times.clear();
+	kernel_items.clear();
+	host_wait_time = 0;
+	profiled_frames = 0;
+	list_rebuilds = 0;
+	max_colour_rounds = 0;
+	reported_steals = cpu_steals();
+}
+
+/*
+	Adds the execution times of the kernels queued this frame to their running totals.
+
+	Must be called once the queue is finished. Every PROFILE_FRAMES frames, prints the
+	average time per frame of every kernel and starts over.
+*/
+void collect_profiling() {
+	accumulate_profiling();
+	if (++profiled_frames < PROFILE_FRAMES) return;
+	print_profiling(PROFILE_FRAMES);
+}
+
+/*
+	Queues an in-place exclusive prefix sum of the first count values of data.
+
+	count must not exceed the size given to create_scan_buffers(). Returns the block sum
+	buffer whose first value ends up holding the total of the count values.
+*/
+cl_mem enqueue_scan(cl_mem data, cl_uint count) {
+	std::vector<cl_uint> counts;
+	size_t level = 0;
+	cl_mem values = data;
+
+	// up-sweep: scan every level per block, collecting the block totals in the next level.
+	while (true) {
+		cl_uint sums_count = (count + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+
+		clSetKernelArg(scan_blocks, 0, sizeof(cl_mem), &values);
+		clSetKernelArg(scan_blocks, 1, sizeof(cl_mem), &d_scan_sums[level]);
+		clSetKernelArg(scan_blocks, 2, sizeof(cl_uint), &count);
+		enqueue_kernel(scan_blocks, sums_count);
+
+		counts.push_back(count);
+		if (sums_count == 1) break;
+
+		values = d_scan_sums[level++];
+		count = sums_count;
+	}
+
+	cl_mem total = d_scan_sums[level];
+
+	// down-sweep: the top level is a single block, every level below needs its block offsets added.
+	while (level > 0) {
+		--level;
+		values = level == 0 ? data : d_scan_sums[level - 1];
+
+		clSetKernelArg(scan_add, 0, sizeof(cl_mem), &values);
+		clSetKernelArg(scan_add, 1, sizeof(cl_mem), &d_scan_sums[level]);
+		clSetKernelArg(scan_add, 2, sizeof(cl_uint), &counts[level]);
+		enqueue_kernel(scan_add, counts[level]);
+	}
+
+	return total;
+}
+
+/*
+	Moves the balls made by init_balls onto the lattice, on the device: lattice_classes flags
+	the balls of every radius class, a scan of the flags ranks every ball in its class, and
+	lattice_place moves every ball to its square from its rank. Only the number of balls of
+	every class, which the host needs to lay out the bands (see fit_lattice()), comes back.
+*/
+cl_int place_on_lattice() {
+	size_t slots_count = RADIUS_CLASSES * balls_count;
+	cl_mem d_lattice_slots = clCreateBuffer(context, CL_MEM_READ_WRITE, slots_count * sizeof(cl_uint), nullptr, &status);
+	if (status != CL_SUCCESS || d_lattice_slots == nullptr) {
+		std::cout << "Failed to allocate a buffer on device." << std::endl;
+		return status;
+	}
+	status = create_scan_buffers(slots_count);
+	if (status != CL_SUCCESS) {
+		clReleaseMemObject(d_lattice_slots);
+		return status;
+	}
+
+	status = set_ball_args(lattice_classes);
+	status |= clSetKernelArg(lattice_classes, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_lattice_slots);
+	status |= clSetKernelArg(lattice_classes, BALL_ARGS_COUNT + 1, sizeof(cl_uint), &balls_count);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to set kernel args." << std::endl;
+		clReleaseMemObject(d_lattice_slots);
+		return status;
+	}
+	enqueue_kernel(lattice_classes, balls_count);
+	enqueue_scan(d_lattice_slots, (cl_uint)slots_count);
+
+	// the first slot of a class holds the number of balls of the classes before it.
+	cl_uint firsts[RADIUS_CLASSES + 1] = {};
+	for (int c = 1; c < RADIUS_CLASSES; ++c) {
+		status |= clEnqueueReadBuffer(cmd_q, d_lattice_slots, CL_FALSE, c * balls_count * sizeof(cl_uint), sizeof(cl_uint), &firsts[c], 0, nullptr, nullptr);
+	}
+	firsts[RADIUS_CLASSES] = (cl_uint)balls_count;
+	clFinish(cmd_q);
+
+	size_t counts[RADIUS_CLASSES];
+	for (int c = 0; c < RADIUS_CLASSES; ++c) counts[c] = firsts[c + 1] - firsts[c];
+	lattice_layout layout;
+	if (status == CL_SUCCESS && fit_lattice(counts, layout)) {
+		cl_uint seed_lo = (cl_uint)seed, seed_hi = (cl_uint)(seed >> 32);
+		status = set_ball_args(lattice_place);
+		status |= clSetKernelArg(lattice_place, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_lattice_slots);
+		status |= clSetKernelArg(lattice_place, BALL_ARGS_COUNT + 1, sizeof(lattice_layout), &layout);
+		status |= clSetKernelArg(lattice_place, BALL_ARGS_COUNT + 2, sizeof(cl_uint), &seed_lo);
+		status |= clSetKernelArg(lattice_place, BALL_ARGS_COUNT + 3, sizeof(cl_uint), &seed_hi);
+		status |= clSetKernelArg(lattice_place, BALL_ARGS_COUNT + 4, sizeof(cl_uint), &balls_count);
+		if (status == CL_SUCCESS) enqueue_kernel(lattice_place, balls_count);
+	}
+
+	// the placement is not part of the first frame's profile.
+	clFinish(cmd_q);
+	for (auto& profiled : profiled_events) clReleaseEvent(profiled.second);
+	profiled_events.clear();
+	profiled_sizes.clear();
+
+	clReleaseMemObject(d_lattice_slots);
+	return status;
+}
+
+/*
+	Queues the uniform grid broad-phase and its narrow-phase (or the neighbour list build).
+
+	Balls are hashed into cells and counting sorted by cell, then every ball is tested
+	against the balls of its 3x3 neighbouring cells only.
+*/
+void enqueue_grid_collide() {
+	cl_uint zero = 0;
+	size_t cells_size = cells_count * sizeof(cl_uint);
+
+	clEnqueueFillBuffer(cmd_q, d_cell_starts, &zero, sizeof(zero), 0, cells_size, 0, nullptr, nullptr);
+	enqueue_kernel(grid_count, balls_count);
+	// cell counts -> cell starts.
+	enqueue_scan(d_cell_starts, cells_count);
+	// the scatter pass advances the starts copy to the cell ends.
+	clEnqueueCopyBuffer(cmd_q, d_cell_starts, d_cell_ends, 0, 0, cells_size, 0, nullptr, nullptr);
+	enqueue_kernel(grid_scatter, balls_count);
+	enqueue_kernel(grid_collide, balls_count);
+}
+
+/*
+	Queues a stable LSD radix sort of the first count key/value pairs of d_sort_keys[0]
+	and d_sort_values[0], on the low key_bits bits of the keys.
+
+	Every pass sorts RADIX_BITS bits and ping-pongs between the two buffers. The number of
+	passes is rounded up to an even number so the result always lands back in buffers 0.
+*/
+void enqueue_radix_sort(cl_uint count, cl_uint key_bits) {
+	cl_uint passes = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+	passes += passes % 2;
+
+	size_t blocks_count = (count + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE;
+
+	for (cl_uint pass = 0; pass < passes; ++pass) {
+		cl_uint shift = pass * RADIX_BITS;
+		int in = pass % 2;
+		int out = 1 - in;
+
+		clSetKernelArg(radix_count, 0, sizeof(cl_mem), &d_sort_keys[in]);
+		clSetKernelArg(radix_count, 1, sizeof(cl_mem), &d_radix_counts);
+		clSetKernelArg(radix_count, 2, sizeof(cl_uint), &shift);
+		clSetKernelArg(radix_count, 3, sizeof(cl_uint), &count);
+		enqueue_kernel(radix_count, blocks_count);
+
+		// digit counts -> where every block writes every digit.
+		enqueue_scan(d_radix_counts, (cl_uint)(RADIX_SIZE * blocks_count));
+
+		clSetKernelArg(radix_scatter, 0, sizeof(cl_mem), &d_sort_keys[in]);
+		clSetKernelArg(radix_scatter, 1, sizeof(cl_mem), &d_sort_values[in]);
+		clSetKernelArg(radix_scatter, 2, sizeof(cl_mem), &d_sort_keys[out]);
+		clSetKernelArg(radix_scatter, 3, sizeof(cl_mem), &d_sort_values[out]);
+		clSetKernelArg(radix_scatter, 4, sizeof(cl_mem), &d_radix_counts);
+		clSetKernelArg(radix_scatter, 5, sizeof(cl_uint), &shift);
+		clSetKernelArg(radix_scatter, 6, sizeof(cl_uint), &count);
+		enqueue_kernel(radix_scatter, blocks_count);
+	}
+}
+
+/*
+	Queues the sort and sweep broad-phase and its narrow-phase (or the neighbour list build).
+
+	Balls are radix sorted by the left edge of their bounding box, then every ball sweeps
+	forward until the left edge of the next ball passes its right edge. Balls resting in a
+	layer on the floor are spread along x, so each one only meets its direct neighbours.
+*/
+void enqueue_sap_collide() {
+	enqueue_kernel(sap_keys, balls_count);
+	enqueue_radix_sort((cl_uint)balls_count, 32);
+	enqueue_kernel(sap_sweep, balls_count);
+}
+
+/*
+	Queues the linear BVH broad-phase and its narrow-phase (or the neighbour list build).
+
+	Balls are radix sorted by the Morton code of their center, the hierarchy is built over
+	the sorted codes and its boxes refitted bottom-up, then every ball walks the tree with its
+	own box. Unlike a fixed grid, the tree adapts to clustered scenes and to the radius spread.
+*/
+void enqueue_bvh_collide() {
+	cl_uint zero = 0;
+	size_t internal_count = balls_count - 1;
+
+	enqueue_kernel(lbvh_morton, balls_count);
+	enqueue_radix_sort((cl_uint)balls_count, 30);
+	if (internal_count > 0) {
+		enqueue_kernel(lbvh_build, internal_count);
+		clEnqueueFillBuffer(cmd_q, d_bvh_flags, &zero, sizeof(zero), 0, internal_count * sizeof(cl_uint), 0, nullptr, nullptr);
+	}
+	else {
+		// a single ball is the root, which lbvh_build would have given no parent.
+		cl_uint no_parent = 0xffffffff;
+		clEnqueueFillBuffer(cmd_q, d_bvh_parents, &no_parent, sizeof(no_parent), 0, sizeof(cl_uint), 0, nullptr, nullptr);
+	}
+	enqueue_kernel(lbvh_bounds, balls_count);
+	enqueue_kernel(lbvh_collide, balls_count);
+}
+
+/*
+	Queues the selected spatial broad-phase.
+*/
+void enqueue_broadphase() {
+	if (broadphase_mode == broadphase::uniform_grid)
+		enqueue_grid_collide();
+	else if (broadphase_mode == broadphase::sort_and_sweep)
+		enqueue_sap_collide();
+	else
+		enqueue_bvh_collide();
+}
+
+/*
+	Reports, once each, the overflows flagged by the device.
+*/
+void report_overflows(const cl_uint* flags) {
+	if (flags[FLAG_LIST_OVERFLOW] && !list_overflow_reported) {
+		std::cout << "A neighbour list overflowed its " << MAX_NEIGHBOURS << " slots, some collisions will be missed." << std::endl;
+		list_overflow_reported = true;
+	}
+	if (flags[FLAG_CONTACT_OVERFLOW] && !contact_overflow_reported) {
+		std::cout << "The contact buffer overflowed its " << contacts_capacity << " slots, some collisions will be missed." << std::endl;
+		contact_overflow_reported = true;
+	}
+	if (flags[FLAG_STACK_OVERFLOW] && !stack_overflow_reported) {
+		std::cout << "A BVH traversal overflowed its " << BVH_STACK_SIZE << " stack slots, some collisions will be missed." << std::endl;
+		stack_overflow_reported = true;
+	}
+}
+
+/*
+	Reads the flags back and reports the overflows. Without neighbour lists or contacts, nothing
+	else reads them, so every PROFILE_FRAMES steps the host waits for the queue to check them.
+*/
+void check_overflows() {
+	cl_uint flags[FLAGS_COUNT];
+	if (clEnqueueReadBuffer(cmd_q, d_flags, CL_TRUE, 0, sizeof(flags), flags, 0, nullptr, nullptr) == CL_SUCCESS) report_overflows(flags);
+}
+
+/*
+	Queues the neighbour list update, rebuilding the lists if needed.
+
+	The lists hold every pair within skin of touching. They stay valid until some ball has
+	moved more than half the skin, which at 30 frames per second takes many frames in a
+	settled scene, so the broad-phase only runs on those frames. Checking requires reading
+	the rebuild flag back before queuing the rest of the frame. Without a skin, the lists
+	only hold the pairs touching right now and are rebuilt every frame.
+*/
+void enqueue_neighbour_lists() {
+	bool rebuild = !lists_built || skin == 0;
+
+	if (!rebuild) {
+		cl_uint zero = 0;
+		cl_uint flags[FLAGS_COUNT];
+
+		clEnqueueFillBuffer(cmd_q, d_flags, &zero, sizeof(zero), FLAG_REBUILD * sizeof(cl_uint), sizeof(cl_uint), 0, nullptr, nullptr);
+		enqueue_kernel(verlet_check, balls_count);
+		clEnqueueReadBuffer(cmd_q, d_flags, CL_TRUE, 0, sizeof(flags), flags, 0, nullptr, nullptr);
+
+		rebuild = flags[FLAG_REBUILD] != 0;
+		report_overflows(flags);
+	}
+
+	if (rebuild) {
+		enqueue_broadphase();
+		if (skin > 0) enqueue_kernel(verlet_snapshot, balls_count);
+		lists_built = true;
+		++list_rebuilds;
+	}
+}
+
+/*
+	Queues the contact detection: the touching pairs of the neighbour lists are compacted
+	into the contact buffer, grouped by ball (count, scan, write). Their accumulated impulses
+	start from the previous frame's when warm starting, from 0 otherwise.
+*/
+void enqueue_contacts() {
+	cl_uint zero = 0;
+
+	clEnqueueFillBuffer(cmd_q, d_contact_starts, &zero, sizeof(zero), 0, (balls_count + 1) * sizeof(cl_uint), 0, nullptr, nullptr);
+	enqueue_kernel(contact_count, balls_count);
+	enqueue_scan(d_contact_starts, (cl_uint)balls_count + 1);
+	clEnqueueCopyBuffer(cmd_q, d_contact_starts, d_contact_cursors, 0, 0, balls_count * sizeof(cl_uint), 0, nullptr, nullptr);
+	enqueue_kernel(contact_write, balls_count);
+
+	if (warm_starting) {
+		enqueue_kernel(contact_warm_start, balls_count);
+	}
+	else {
+		float no_impulse = 0.f;
+		clEnqueueFillBuffer(cmd_q, d_impulses, &no_impulse, sizeof(no_impulse), 0, contacts_capacity * sizeof(float), 0, nullptr, nullptr);
+	}
+}
+
+/*
+	Queues the copy of the contacts and their accumulated impulses, for the next frame
+	to warm start from.
+*/
+void enqueue_keep_contacts() {
+	if (!warm_starting) return;
+
+	clEnqueueCopyBuffer(cmd_q, d_contact_starts, d_prev_starts, 0, 0, (balls_count + 1) * sizeof(cl_uint), 0, nullptr, nullptr);
+	clEnqueueCopyBuffer(cmd_q, d_contacts, d_prev_contacts, 0, 0, contacts_capacity * sizeof(cl_uint2), 0, nullptr, nullptr);
+	clEnqueueCopyBuffer(cmd_q, d_impulses, d_prev_impulses, 0, 0, contacts_capacity * sizeof(float), 0, nullptr, nullptr);
+}
+
+/*
+	Queues the contact colouring, which also resolves the contacts batch by batch.
+
+	Every round colours a set of contacts sharing no ball (each ball goes to the contact of
+	lowest random priority claiming it) and resolves them at once. As many rounds as the last
+	frame used colours (at least MIN_COLOUR_ROUNDS) are queued back to back, then the flags
+	are read back: in a settled scene the colouring ends there, with one read per frame, and
+	otherwise twice as many rounds follow. Rounds past the last contact colour nothing. The
+	read is needed, as the solver sweeps below are queued one batch per colour used. Every
+	further solver iteration then sweeps the colours again, and a last sweep applies the
+	restitution.
+*/
+void enqueue_colour_collide() {
+	cl_uint zero = 0, none = NO_COLOUR;
+	cl_uint flags[FLAGS_COUNT];
+
+	enqueue_contacts();
+	clEnqueueFillBuffer(cmd_q, d_contact_colours, &none, sizeof(none), 0, contacts_capacity * sizeof(cl_uint), 0, nullptr, nullptr);
+
+	clEnqueueFillBuffer(cmd_q, d_flags, &zero, sizeof(zero), FLAG_COLOURS * sizeof(cl_uint), sizeof(cl_uint), 0, nullptr, nullptr);
+
+	cl_uint colour = 0, rounds = std::max(colours_used, (cl_uint)MIN_COLOUR_ROUNDS);
+	do {
+		for (cl_uint i = 0; i < rounds; ++i, ++colour) {
+			// only the last round of the batch tells whether contacts are left.
+			if (i == rounds - 1)
+				clEnqueueFillBuffer(cmd_q, d_flags, &zero, sizeof(zero), FLAG_UNRESOLVED * sizeof(cl_uint), sizeof(cl_uint), 0, nullptr, nullptr);
+			clEnqueueFillBuffer(cmd_q, d_claims, &none, sizeof(none), 0, balls_count * sizeof(cl_uint), 0, nullptr, nullptr);
+
+			clSetKernelArg(colour_claim, 4, sizeof(cl_uint), &colour);
+			enqueue_kernel(colour_claim, balls_count);
+			clSetKernelArg(colour_resolve, BALL_ARGS_COUNT + 7, sizeof(cl_uint), &colour);
+			enqueue_kernel(colour_resolve, balls_count);
+		}
+		rounds *= 2;
+
+		clEnqueueReadBuffer(cmd_q, d_flags, CL_TRUE, 0, sizeof(flags), flags, 0, nullptr, nullptr);
+	} while (flags[FLAG_UNRESOLVED]);
+
+	report_overflows(flags);
+	colours_used = flags[FLAG_COLOURS];
+	max_colour_rounds = std::max(max_colour_rounds, colours_used);
+
+	for (int iteration = 1; iteration <= solver_iterations; ++iteration) {
+		cl_uint stage = iteration < solver_iterations ? SOLVE_ITERATION : SOLVE_RESTITUTION;
+		clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 6, sizeof(cl_uint), &stage);
+
+		for (cl_uint batch = 0; batch < colours_used; ++batch) {
+			clSetKernelArg(colour_solve, BALL_ARGS_COUNT + 5, sizeof(cl_uint), &batch);
+			enqueue_kernel(colour_solve, balls_count);
+		}
+	}
+
+	enqueue_keep_contacts();
+}
+
+/*
+	Queues the gather resolve: every pass has every ball read its own range of contacts and
+	write its new center and velocity to d_resolved_center and d_resolved_velocity, which are
+	then copied back over d_center and d_velocity. The first pass warm starts and separates
+	the balls, then there is one pass per solver iteration and a last one for the restitution.
+*/
+void enqueue_gather_collide() {
+	enqueue_contacts();
+
+	size_t resolved_size = balls_count * sizeof(cl_float2);
+
+	enqueue_kernel(gather_prepare, balls_count);
+	clEnqueueCopyBuffer(cmd_q, d_resolved_center, d_center, 0, 0, resolved_size, 0, nullptr, nullptr);
+	clEnqueueCopyBuffer(cmd_q, d_resolved_velocity, d_velocity, 0, 0, resolved_size, 0, nullptr, nullptr);
+
+	for (int iteration = 0; iteration <= solver_iterations; ++iteration) {
+		cl_uint stage = iteration < solver_iterations ? SOLVE_ITERATION : SOLVE_RESTITUTION;
+		clSetKernelArg(gather_resolve, BALL_ARGS_COUNT + 6, sizeof(cl_uint), &stage);
+
+		enqueue_kernel(gather_resolve, balls_count);
+		clEnqueueCopyBuffer(cmd_q, d_resolved_center, d_center, 0, 0, resolved_size, 0, nullptr, nullptr);
+		clEnqueueCopyBuffer(cmd_q, d_resolved_velocity, d_velocity, 0, 0, resolved_size, 0, nullptr, nullptr);
+	}
+
+	enqueue_keep_contacts();
+}
+
+/*
+	Returns the total momentum of the balls, from their velocities read back from the device.
+*/
+cl_double2 total_momentum() {
+	std::vector<cl_float2> velocities(balls_count);
+	cl_double2 momentum = { 0, 0 };
+
+	clEnqueueReadBuffer(cmd_q, d_velocity, CL_TRUE, 0, balls_count * sizeof(cl_float2), velocities.data(), 0, nullptr, nullptr);
+	for (size_t i = 0; i < balls_count; ++i) {
+		momentum.x += velocities[i].x / balls.inv_mass[i];
+		momentum.y += velocities[i].y / balls.inv_mass[i];
+	}
+
+	return momentum;
+}
+
+/*
+	Queues the ball-ball stage of the frame: broad-phase, neighbour lists and narrow-phase.
+
+	With check_momentum, the momentum before and after the stage is compared. Collisions
+	conserve it, so any drift comes from contacts sharing a ball updated concurrently. The
+	largest drift is printed every PROFILE_FRAMES steps.
+*/
+void enqueue_collisions() {
+	cl_double2 before;
+	if (check_momentum) before = total_momentum();
+
+	if (broadphase_mode == broadphase::brute_force) {
+		enqueue_kernel(ball_bounce, pairs_count);
+	}
+	else if (neighbour_lists) {
+		enqueue_neighbour_lists();
+		if (resolve_mode == resolve::colour) enqueue_colour_collide();
+		else if (resolve_mode == resolve::gather) enqueue_gather_collide();
+		else enqueue_kernel(verlet_collide, balls_count);
+	}
+	else {
+		enqueue_broadphase();
+	}
+
+	if (!check_momentum) return;
+
+	cl_double2 after = total_momentum();
+	max_momentum_drift = std::max(max_momentum_drift, hypot(after.x - before.x, after.y - before.y));
+
+	if (++checked_frames < PROFILE_FRAMES) return;
+	std::cout << "Largest momentum drift of a collision stage over " << PROFILE_FRAMES << " steps: " << max_momentum_drift << std::endl;
+	checked_frames = 0;
+	max_momentum_drift = 0;
+}
+
+/*
+	Draws the balls as instances of the unit circle mesh, in a single draw call.
+
+	The mesh advances per vertex, the instance (center and radius) and colour buffers per ball.
+*/
+void draw_instanced() {
+	glUseProgram(circle_program);
+
+	glBindBuffer(GL_ARRAY_BUFFER, circle_vbo);
+	glEnableVertexAttribArray(vertex_location);
+	glVertexAttribPointer(vertex_location, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(instance_location);
+	glVertexAttribPointer(instance_location, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(instance_location, 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+	glEnableVertexAttribArray(color_location);
+	glVertexAttribPointer(color_location, 3, GL_FLOAT, GL_FALSE, sizeof(cl_float3), 0);
+	glVertexAttribDivisor(color_location, 1);
+
+	glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, NUM_POINTS, (GLsizei)balls_count);
+
+	glDisableVertexAttribArray(vertex_location);
+	glDisableVertexAttribArray(instance_location);
+	glDisableVertexAttribArray(color_location);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+}
+
+/*
+	Draws every ball as a single point sprite, in a single draw call.
+
+	The sprite is sized from the viewport so that it is as wide as the ball, then the fragment
+	shader discards its corners: nothing is tessellated, CL only writes one instance per ball.
+*/
+void draw_points() {
+	GLint viewport[4] = { 0, 0, WWIDTH, WHEIGHT };
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	glUseProgram(circle_program);
+	// the [-1, 1] box spans the viewport's width.
+	glUniform1f(pixels_per_unit_location, 0.5f * viewport[2]);
+	glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	glEnable(GL_POINT_SPRITE);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(instance_location);
+	glVertexAttribPointer(instance_location, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+	glEnableVertexAttribArray(color_location);
+	glVertexAttribPointer(color_location, 3, GL_FLOAT, GL_FALSE, sizeof(cl_float3), 0);
+
+	glDrawArrays(GL_POINTS, 0, (GLsizei)balls_count);
+
+	glDisableVertexAttribArray(instance_location);
+	glDisableVertexAttribArray(color_location);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisable(GL_POINT_SPRITE);
+	glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	glUseProgram(0);
+}
+
+/*
+	Draws the balls.
+*/
+void draw() {
+	glClearColor(0.25f, 0.25f, 0.25f, 1.f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (render_mode == render::instanced) {
+		draw_instanced();
+	}
+	else if (render_mode == render::points) {
+		draw_points();
+	}
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(2, GL_FLOAT, 0, 0);
+		for (unsigned int i = 0; i < balls_count; ++i) {
+			cl_float3& color = colors[i];
+			glColor4f(color.x, color.y, color.z, 0.25f);
+			// update_vbo only wrote the first lod_counts[i] vertices of the ball.
+			glDrawArrays(lod_counts[i] == 1 ? GL_POINTS : GL_POLYGON, i * NUM_POINTS, lod_counts[i]);
+		}
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	glutSwapBuffers();
+}
+
+/*
+	Chooses the vertices of every ball from its radius on screen when the viewport's width has
+	changed (it starts at WWIDTH), and hands the vertex steps to update_vbo.
+
+	A ball gets one vertex every LOD_EDGE_PIXELS along its outline, between LOD_MIN_POINTS and
+	NUM_POINTS, taken as every step-th vertex of the unit circle. Balls less than a pixel across
+	collapse to their center. The radii never change, so this only runs again on a resize.
+
+	Returns true when the vertices changed.
+*/
+bool update_lod() {
+	GLint viewport[4] = { 0, 0, WWIDTH, WHEIGHT };
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if (!lod || viewport[2] == lod_width) return false;
+	lod_width = viewport[2];
+
+	// the [-1, 1] box spans the viewport's width.
+	float pixels_per_unit = 0.5f * lod_width;
+	size_t vertices = 0;
+	for (size_t i = 0; i < balls_count; ++i) {
+		float pixel_radius = balls.radius[i] * pixels_per_unit;
+		cl_uint step = NUM_POINTS;
+		if (pixel_radius >= 0.5f) {
+			int points = (int)ceil(2.f * PI * pixel_radius / LOD_EDGE_PIXELS);
+			points = std::min(std::max(points, LOD_MIN_POINTS), NUM_POINTS);
+			step = NUM_POINTS / points;
+		}
+		lod_steps[i] = step;
+		lod_counts[i] = (NUM_POINTS + step - 1) / step;
+		vertices += lod_counts[i];
+	}
+
+	// the CPU backend reads lod_steps directly.
+	if (d_lod_steps) clEnqueueWriteBuffer(cmd_q, d_lod_steps, CL_TRUE, 0, balls_count * sizeof(cl_uint), lod_steps.data(), 0, nullptr, nullptr);
+	kernel_traffic["update_vbo"] = sizeof(cl_float2) + sizeof(cl_float) + sizeof(cl_uint) + vertices * sizeof(cl_float2) / balls_count;
+	return true;
+}
+
+/*
+	Updates the frame 30 times per second.
+
+	Queues OpenCL kernel calls that will execute on the device to compute
+	ball-wall and ball-ball collisions, substeps times per frame. It then uses
+	the new values to render the new frame.
+
+	The new values go to the next of the shared_vbos VBOs in rotation, while GL draws the one
+	written the frame before: CL computes frame N+1 as GL renders frame N, and the host only
+	waits for the VBO it is about to draw. The frame on screen is one frame behind the
+	simulation (not with --vbos 1).
+*/
+void update() {
+	//update current clock time
+	current_t = clock();
+	delta_t = (float)(current_t - previous_t) / CLOCKS_PER_SEC;
+
+	// don't draw if delta_t is faster than 30 fps
+	if (delta_t < UPDATE_FREQ) return;
+
+	// store last draw time
+	previous_t = current_t;
+
+	// the simulation advances in fixed steps of step_t: the frame time is banked and spent
+	// one step at a time, the remainder being carried over to the next frame.
+	accumulated_t += std::min(delta_t, MAX_FRAME_TIME);
+
+	// steps are queued back to back, the host only waits in between for the neighbour list
+	// check (--skin) and the colouring (--resolve colour).
+	while (accumulated_t >= step_t) {
+		// queue ball-wall collision computation
+		enqueue_kernel(wall_bounce, balls_count);
+		// queue ball-ball collision computation
+		enqueue_collisions();
+		step_done();
+
+		accumulated_t -= step_t;
+	}
+	
+	// a vbo written with the previous vertices would not match the new vertex counts.
+	bool lod_changed = render_mode == render::polygons && update_lod();
+
+	// the vbo written the frame before is drawn, unless it was never written or there is a
+	// single vbo: then it is the one written this frame.
+	int drawn_vbo = written_vbo;
+	written_vbo = (written_vbo + 1) % shared_vbos;
+	if (lod_changed || !vbo_events[drawn_vbo]) drawn_vbo = written_vbo;
+
+	auto wait_start = std::chrono::steady_clock::now();
+
+	// GL must be done with the vbo before CL acquires it (the last draw, a frame ago, read a
+	// different vbo unless there is only one): either the acquire waits on a fence behind the
+	// last draw, or the host waits for all OpenGL routines to finish.
+	cl_event gl_done = nullptr;
+	if (create_event_from_gl_sync) {
+		// the fence this vbo's last acquire waited on is done with once that acquire is.
+		if (vbo_events[written_vbo]) clWaitForEvents(1, &vbo_events[written_vbo]);
+		if (fence_events[written_vbo]) clReleaseEvent(fence_events[written_vbo]);
+		if (vbo_fences[written_vbo]) glDeleteSync(vbo_fences[written_vbo]);
+
+		vbo_fences[written_vbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		fence_events[written_vbo] = gl_done = create_event_from_gl_sync(context, (cl_GLsync)vbo_fences[written_vbo], nullptr);
+	}
+	if (!gl_done) glFinish();
+	// acquire shared data.
+	clEnqueueAcquireGLObjects(cmd_q, 1, &d_vbos[written_vbo], gl_done ? 1 : 0, gl_done ? &gl_done : nullptr, nullptr);
+	// queue update_vbo (or update_instances) kernel to update vbo values for OpenGL.
+	cl_kernel update_kernel = render_mode == render::polygons ? update_vbo : update_instances;
+	clSetKernelArg(update_kernel, BALL_ARGS_COUNT + 0, sizeof(cl_mem), &d_vbos[written_vbo]);
+	enqueue_kernel(update_kernel, balls_count);
+	// release shared data.
+	if (vbo_events[written_vbo]) clReleaseEvent(vbo_events[written_vbo]);
+	clEnqueueReleaseGLObjects(cmd_q, 1, &d_vbos[written_vbo], 0, nullptr, &vbo_events[written_vbo]);
+	clFlush(cmd_q);
+
+	// CL must be done with the vbo before OpenGL draws it: either GL waits on its release, or
+	// the host does.
+	if (gl_waits_cl) {
+		GLsync cl_done = glCreateSyncFromCLeventARB(context, vbo_events[drawn_vbo], 0);
+		glWaitSync(cl_done, 0, GL_TIMEOUT_IGNORED);
+		glDeleteSync(cl_done);
+	}
+	else {
+		clWaitForEvents(1, &vbo_events[drawn_vbo]);
+	}
+	host_wait_time += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+
+	vbo = vbos[drawn_vbo];
+	draw();
+
+	// the kernel times are read once the queue is done, which serializes the frames (but not
+	// the handoff above).
+	if (profiling) {
+		clFinish(cmd_q);
+		collect_profiling();
+	}
+}
+
+/*
+	Runs a stage of the CPU backend, adding its time to its own running total when profiling.
+	Stages are named after the engine's functions, not the kernels they replace, so that they
+	stay out of kernel_traffic: their memory traffic is not the kernels'.
+*/
+void run_cpu_stage(const char* name, const std::function<void()>& stage) {
+	if (!profiling) {
+		stage();
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	stage();
+	kernel_times[name] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+	One step of the CPU backend: wall collisions, then the uniform grid if any, then ball
+	collisions.
+*/
+void step_cpu() {
+	run_cpu_stage("cpu_wall_bounce", [] { cpu_wall_bounce(step_t, gravity); });
+	if (broadphase_mode == broadphase::uniform_grid) run_cpu_stage("cpu_broad_phase", [] { cpu_broad_phase(); });
+	run_cpu_stage("cpu_ball_bounce", [] { cpu_ball_bounce(); });
+}
+
+/*
+	update() of the CPU backend: runs substeps steps of the native engine per frame, 30 times
+	per second, then writes the balls straight to the mapped vbo and draws it.
+*/
+void update_cpu() {
+	current_t = clock();
+	delta_t = (float)(current_t - previous_t) / CLOCKS_PER_SEC;
+	if (delta_t < UPDATE_FREQ) return;
+	previous_t = current_t;
+
+	accumulated_t += std::min(delta_t, MAX_FRAME_TIME);
+	while (accumulated_t >= step_t) {
+		step_cpu();
+		step_done();
+		accumulated_t -= step_t;
+	}
+
+	if (render_mode == render::polygons) update_lod();
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	float* mapped = (float*)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+	if (mapped) {
+		if (render_mode == render::polygons) {
+			run_cpu_stage("cpu_update_vbo", [mapped] {
+				cpu_update_vbo(mapped, (const float*)circle_table.data(), lod_steps.data(), NUM_POINTS);
+			});
+		}
+		else {
+			run_cpu_stage("cpu_update_instances", [mapped] { cpu_update_instances(mapped); });
+		}
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	draw();
+
+	if (profiling) collect_profiling();
+}
+
+/*
+	Runs headless_steps steps of the simulation back to back, with no window and no frame
+	rate cap, then prints the throughput in ball-steps per second and the average time of
+	every kernel per step.
+
+	The queue is finished every PROFILE_FRAMES steps to release the profiling events, which
+	is counted in the throughput.
+*/
+void run_headless() {
+	std::cout << "Running " << headless_steps << " steps of " << balls_count << " balls." << std::endl << std::endl;
+	auto start = std::chrono::steady_clock::now();
+
+	for (long long step = 1; step <= headless_steps; ++step) {
+		if (backend_mode == backend::cpu) {
+			step_cpu();
+			step_done();
+			continue;
+		}
+
+		enqueue_kernel(wall_bounce, balls_count);
+		enqueue_collisions();
+		step_done();
+
+		if (step % PROFILE_FRAMES == 0 || step == headless_steps) {
+			clFinish(cmd_q);
+			accumulate_profiling();
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Steps per second: " << headless_steps / seconds << std::endl;
+	std::cout << "Ball-steps per second: " << headless_steps * (double)balls_count / seconds << std::endl << std::endl;
+	print_profiling(headless_steps);
+
+	// the last step's checkpoint, unless step_done() just saved it.
+	if (checkpoint_path.empty()) return;
+	if (saved_steps != simulated_steps) save_checkpoint();
+	if (saved_steps == simulated_steps) std::cout << "Checkpoint at step " << simulated_steps << ": " << checkpoint_path << std::endl;
+}
+
+/*
+	Frees all the resources.
+*/
+void cleanup() {
+	if (program_builder.joinable()) program_builder.join();
+	cpu_destroy();
+	for (GLuint shared : vbos) if (shared) glDeleteBuffers(1, &shared);
+	if (circle_vbo) glDeleteBuffers(1, &circle_vbo);
+	if (color_vbo) glDeleteBuffers(1, &color_vbo);
+	if (circle_program) glDeleteProgram(circle_program);
+#define RELEASE_BALL_BUFFER(type, name) if (d_##name) clReleaseMemObject(d_##name);
+	BALL_FIELDS(RELEASE_BALL_BUFFER)
+#undef RELEASE_BALL_BUFFER
+	if (d_cell_ids) clReleaseMemObject(d_cell_ids);
+	if (d_cell_starts) clReleaseMemObject(d_cell_starts);
+	if (d_cell_ends) clReleaseMemObject(d_cell_ends);
+	if (d_sorted) clReleaseMemObject(d_sorted);
+	for (cl_mem sums : d_scan_sums) clReleaseMemObject(sums);
+	for (int i = 0; i < 2; ++i) {
+		if (d_sort_keys[i]) clReleaseMemObject(d_sort_keys[i]);
+		if (d_sort_values[i]) clReleaseMemObject(d_sort_values[i]);
+	}
+	if (d_radix_counts) clReleaseMemObject(d_radix_counts);
+	if (d_bvh_children) clReleaseMemObject(d_bvh_children);
+	if (d_bvh_parents) clReleaseMemObject(d_bvh_parents);
+	if (d_bvh_bounds) clReleaseMemObject(d_bvh_bounds);
+	if (d_bvh_flags) clReleaseMemObject(d_bvh_flags);
+	if (d_neighbours) clReleaseMemObject(d_neighbours);
+	if (d_neighbour_counts) clReleaseMemObject(d_neighbour_counts);
+	if (d_build_centers) clReleaseMemObject(d_build_centers);
+	if (d_flags) clReleaseMemObject(d_flags);
+	if (d_contact_starts) clReleaseMemObject(d_contact_starts);
+	if (d_contact_cursors) clReleaseMemObject(d_contact_cursors);
+	if (d_contacts) clReleaseMemObject(d_contacts);
+	if (d_contact_colours) clReleaseMemObject(d_contact_colours);
+	if (d_claims) clReleaseMemObject(d_claims);
+	if (d_resolved_center) clReleaseMemObject(d_resolved_center);
+	if (d_resolved_velocity) clReleaseMemObject(d_resolved_velocity);
+	if (d_impulses) clReleaseMemObject(d_impulses);
+	if (d_biases) clReleaseMemObject(d_biases);
+	if (d_prev_contacts) clReleaseMemObject(d_prev_contacts);
+	if (d_prev_starts) clReleaseMemObject(d_prev_starts);
+	if (d_prev_impulses) clReleaseMemObject(d_prev_impulses);
+	for (int i = 0; i < MAX_SHARED_VBOS; ++i) {
+		if (vbo_fences[i]) glDeleteSync(vbo_fences[i]);
+		if (fence_events[i]) clReleaseEvent(fence_events[i]);
+		if (vbo_events[i]) clReleaseEvent(vbo_events[i]);
+		if (d_vbos[i]) clReleaseMemObject(d_vbos[i]);
+	}
+	if (d_circle) clReleaseMemObject(d_circle);
+	if (d_lod_steps) clReleaseMemObject(d_lod_steps);
+	if (cmd_q) clReleaseCommandQueue(cmd_q);
+	if (wall_bounce) clReleaseKernel(wall_bounce);
+	if (ball_bounce) clReleaseKernel(ball_bounce);
+	if (update_vbo) clReleaseKernel(update_vbo);
+	if (update_instances) clReleaseKernel(update_instances);
+	if (scan_blocks) clReleaseKernel(scan_blocks);
+	if (scan_add) clReleaseKernel(scan_add);
+	if (grid_count) clReleaseKernel(grid_count);
+	if (grid_scatter) clReleaseKernel(grid_scatter);
+	if (grid_collide) clReleaseKernel(grid_collide);
+	if (radix_count) clReleaseKernel(radix_count);
+	if (radix_scatter) clReleaseKernel(radix_scatter);
+	if (sap_keys) clReleaseKernel(sap_keys);
+	if (sap_sweep) clReleaseKernel(sap_sweep);
+	if (lbvh_morton) clReleaseKernel(lbvh_morton);
+	if (lbvh_build) clReleaseKernel(lbvh_build);
+	if (lbvh_bounds) clReleaseKernel(lbvh_bounds);
+	if (lbvh_collide) clReleaseKernel(lbvh_collide);
+	if (verlet_check) clReleaseKernel(verlet_check);
+	if (verlet_snapshot) clReleaseKernel(verlet_snapshot);
+	if (verlet_collide) clReleaseKernel(verlet_collide);
+	if (contact_count) clReleaseKernel(contact_count);
+	if (contact_write) clReleaseKernel(contact_write);
+	if (colour_claim) clReleaseKernel(colour_claim);
+	if (colour_resolve) clReleaseKernel(colour_resolve);
+	if (contact_warm_start) clReleaseKernel(contact_warm_start);
+	if (colour_solve) clReleaseKernel(colour_solve);
+	if (gather_prepare) clReleaseKernel(gather_prepare);
+	if (gather_resolve) clReleaseKernel(gather_resolve);
+	if (init_balls) clReleaseKernel(init_balls);
+	if (lattice_classes) clReleaseKernel(lattice_classes);
+	if (lattice_place) clReleaseKernel(lattice_place);
+	if (program) clReleaseProgram(program);
+	if (context) clReleaseContext(context);
+}
+
+int main(int argc, char** argv) {
+	init(argc, argv);
+
+	// the CPU backend never calls into OpenCL, so it runs without an OpenCL runtime.
+	if (backend_mode == backend::cpu) {
+		make_balls();
+		cpu_create(balls_count, (const float*)balls.center.data(), (const float*)balls.velocity.data(),
+			balls.radius.data(), balls.inv_mass.data(), cpu_threads, simd_mode,
+			broadphase_mode == broadphase::uniform_grid ? 2 * MAX_RADIUS : 0.f);
+
+		if (headless) {
+			run_headless();
+			cleanup();
+			return 0;
+		}
+
+		create_cpu_buffers();
+		if (render_mode != render::polygons) {
+			create_circle_program();
+			if (!circle_program) {
+				cleanup();
+				std::exit(1);
+			}
+		}
+
+		glutDisplayFunc(update_cpu);
+		glutIdleFunc(update_cpu);
+		glutMainLoop();
+
+		cleanup();
+		return 0;
+	}
+
+	create_context();
+	if (!context) {
+		std::cout << "Failed to create an OpenCL context." << std::endl;
+		cleanup();
+		std::exit(1);
+	}
+
+	status = clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, nullptr);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to get device from context." << std::endl;
+		cleanup();
+		std::exit(1);
+	}
+
+	// the build only needs the device: it overlaps with creating the queue and the buffers.
+	program_builder = std::thread(create_program, 1);
+
+	cmd_q = clCreateCommandQueue(context, device, profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &status);
+	if (status != CL_SUCCESS) {
+		std::cout << "Failed to get device from context." << std::endl;
+		cleanup();
+		std::exit(1);
+	}
+
+	status = create_clgl_buffers();
+	if (status != CL_SUCCESS) {
+		cleanup();
+		std::exit(1);
+	}
+
+	program_builder.join();
+	if (!program) {
+		cleanup();
+		std::exit(1);
+	}
+
+	status = create_kernels();
+	if (status != CL_SUCCESS) {
+		cleanup();
+		std::exit(1);
+	}
+
+	status = create_balls_on_device();
+	if (status != CL_SUCCESS) {
+		cleanup();
+		std::exit(1);
+	}
+
+	if (headless) {
+		run_headless();
+		cleanup();
+		return 0;
+	}
+
+	create_sync_objects();
+
+	if (render_mode != render::polygons) {
+		create_circle_program();
+		if (!circle_program) {
+			cleanup();
+			std::exit(1);
+		}
 	}
 	
 	glutMainLoop();
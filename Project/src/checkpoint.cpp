@@ -0,0 +1,93 @@
+#include "checkpoint.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool map_file(const char* path, mapped_file& file) {
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	// the mapping keeps its own reference to the file.
+	HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(handle);
+	if (!mapping) return false;
+
+	const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		return false;
+	}
+
+	file.data = (const unsigned char*)data;
+	file.size = (size_t)size.QuadPart;
+	file.handle = mapping;
+	return true;
+}
+
+void unmap_file(mapped_file& file) {
+	if (file.data) UnmapViewOfFile(file.data);
+	if (file.handle) CloseHandle((HANDLE)file.handle);
+	file = mapped_file();
+}
+
+bool replace_file(const char* from, const char* to) {
+	// write-through returns once the move, and the data before it, is on disk.
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+#else
+
+bool map_file(const char* path, mapped_file& file) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	// the mapping outlives the descriptor.
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+	madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	file.data = (const unsigned char*)data;
+	file.size = (size_t)info.st_size;
+	return true;
+}
+
+void unmap_file(mapped_file& file) {
+	if (file.data) munmap((void*)file.data, file.size);
+	file = mapped_file();
+}
+
+bool replace_file(const char* from, const char* to) {
+	// the data goes to disk first, or a crash after the rename could leave an empty file.
+	int fd = open(from, O_RDONLY);
+	if (fd < 0) return false;
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	// rename replaces to atomically on POSIX.
+	return synced && rename(from, to) == 0;
+}
+
+#endif
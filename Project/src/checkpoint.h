@@ -0,0 +1,68 @@
+/*
+	Checkpoint file of the simulation: the state of every ball, the steps taken so far, the
+	seed and the configuration the kernels were built with, so that a run resumes where it
+	stopped with --restore.
+
+	The file is laid out to be used in place: a fixed-size header, then one array per ball
+	field (see ball_layout.h) in BALL_FIELDS order, each exactly as the device buffer holds
+	it and starting on a CHECKPOINT_ALIGNMENT boundary. Restoring maps the file and hands
+	the arrays straight to the device or the CPU engine, with nothing to parse. Integers and
+	floats are stored as the host has them (little-endian, IEEE 754).
+*/
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKPOINT_MAGIC "BBALLCKP"
+// bumped on any change of the layout, older files are refused.
+#define CHECKPOINT_VERSION 1
+// a page, so that the mapped arrays are as aligned as any buffer the runtime allocates.
+#define CHECKPOINT_ALIGNMENT 4096
+#define CHECKPOINT_MAX_FIELDS 8
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t balls_count;
+	uint64_t seed;
+	// steps simulated since the scene was made, of step_t seconds each.
+	int64_t steps;
+	float step_t;
+	int32_t substeps;
+	float gravity;
+	float restitution;
+	float resting_speed;
+	float min_radius;
+	uint32_t num_points;
+	uint32_t fields_count;
+	// where every field's array starts in the file, and the size of one of its elements.
+	uint64_t field_offsets[CHECKPOINT_MAX_FIELDS];
+	uint32_t field_sizes[CHECKPOINT_MAX_FIELDS];
+};
+
+// first multiple of CHECKPOINT_ALIGNMENT from offset.
+inline uint64_t checkpoint_align(uint64_t offset) {
+	return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+// a file mapped read-only in memory.
+struct mapped_file {
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	void* handle = nullptr;
+};
+
+// maps the file at path. Returns false, with nothing mapped, if it cannot.
+bool map_file(const char* path, mapped_file& file);
+
+// unmaps the file, if mapped.
+void unmap_file(mapped_file& file);
+
+// moves the file at from, once on disk, over the one at to in a single step: readers see
+// either the old file or the new one, never a partial one. Returns false if it cannot.
+bool replace_file(const char* from, const char* to);
+
+#endif
@@ -0,0 +1,529 @@
+#include "cpu_engine.h"
+#include "scheduler.h"
+#include <immintrin.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// largest range of a parallel_for: balls streamed once (integration, binning, vertices), and
+// balls tested against their neighbours, whose cost varies the most.
+#define STREAM_GRAIN 4096
+#define PAIR_GRAIN 64
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles any intrinsic without per-function targets.
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+simd detect_simd() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, then the OS saves the XMM and YMM registers.
+	bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+	if (!avx) return simd::scalar;
+
+	__cpuidex(info, 7, 0);
+	// AVX-512F, then the OS also saves the opmask and ZMM registers.
+	if ((info[1] & (1 << 16)) && (_xgetbv(0) & 0xe6) == 0xe6) return simd::avx512;
+	if (info[1] & (1 << 5)) return simd::avx2;
+	return simd::scalar;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return simd::avx512;
+	if (__builtin_cpu_supports("avx2")) return simd::avx2;
+	return simd::scalar;
+#endif
+}
+
+//////////Engine variables//////////
+// private to the engine, the host has its own globals.
+static size_t count = 0;
+static simd isa = simd::scalar;
+static scheduler* pool = nullptr;
+// one array per coordinate, and the same arrays being written by cpu_ball_bounce (or reordered
+// by cpu_broad_phase). ids holds the index of every ball in the host's order.
+static std::vector<float> cx, cy, vx, vy, radius, inv_mass;
+static std::vector<float> next_cx, next_cy, next_vx, next_vy, next_radius, next_inv_mass;
+static std::vector<unsigned int> ids, next_ids;
+// uniform grid: the balls are kept sorted by cell, cell c holding [cell_starts[c], cell_starts[c + 1]).
+static bool grid = false;
+static float cell_size;
+static int grid_dim;
+static std::vector<unsigned int> cells, cell_starts, next_cells;
+// counting sort: the balls of every cell in every chunk of STREAM_GRAIN balls, chunk-major,
+// turned into where the chunk's balls of the cell start within the cell.
+static std::vector<unsigned int> chunk_counts;
+// balls touching every ball, as floats for the vector loads.
+static std::vector<float> contacts;
+
+// response of ball i to the pairs it is part of: position correction and velocity change.
+struct response {
+	float x = 0.f, y = 0.f, vx = 0.f, vy = 0.f;
+};
+
+/*
+	Returns the number of balls in [begin, end) touching ball i, i itself excluded as it sits at
+	distance 0 (as are balls sharing its exact center).
+*/
+static float count_row(size_t i, size_t begin, size_t end) {
+	float xi = cx[i], yi = cy[i], ri = radius[i];
+	float touching = 0.f;
+
+	for (size_t j = begin; j < end; ++j) {
+		float dx = xi - cx[j];
+		float dy = yi - cy[j];
+		float mag = dx * dx + dy * dy;
+		float min_dist = ri + radius[j];
+		if (mag <= min_dist * min_dist && mag > 0.f) touching += 1.f;
+	}
+	return touching;
+}
+
+/*
+	Adds the response of ball i to its collisions with balls [begin, end), computed as collide()
+	in bouncing_balls.cl seen from ball i: both balls are pushed apart by half their overlap,
+	and exchange velocity along their axis, the lighter one taking the larger share.
+
+	As in the gather resolve, the exchange with a ball is divided between the contacts of the
+	busier of the two, and the push is averaged over the contacts of i by the caller, so that
+	a ball in a pile is not pushed and bounced once per neighbour.
+*/
+static void collide_row(size_t i, size_t begin, size_t end, response& r) {
+	float xi = cx[i], yi = cy[i], ri = radius[i], vxi = vx[i], vyi = vy[i], mi = inv_mass[i], ci = contacts[i];
+
+	for (size_t j = begin; j < end; ++j) {
+		float dx = xi - cx[j];
+		float dy = yi - cy[j];
+		float mag = dx * dx + dy * dy;
+		float min_dist = ri + radius[j];
+		if (mag > min_dist * min_dist || mag == 0.f) continue;
+
+		float dist = sqrt(mag);
+		float push = 0.5f * (min_dist - dist) / dist;
+		r.x += push * dx;
+		r.y += push * dy;
+
+		float ratio = 2.f * ((vxi - vx[j]) * dx + (vyi - vy[j]) * dy) / ((mi + inv_mass[j]) * mag * std::max(ci, contacts[j]));
+		r.vx -= mi * ratio * dx;
+		r.vy -= mi * ratio * dy;
+	}
+}
+
+SIMD_TARGET("avx2")
+static float horizontal_sum(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+// lanes of balls touching ball i (xi, yi, ri broadcast) among the 8 from j.
+SIMD_TARGET("avx2")
+static __m256 touching_avx2(__m256 xi, __m256 yi, __m256 ri, size_t j, __m256* dx, __m256* dy, __m256* mag, __m256* min_dist) {
+	*dx = _mm256_sub_ps(xi, _mm256_loadu_ps(&cx[j]));
+	*dy = _mm256_sub_ps(yi, _mm256_loadu_ps(&cy[j]));
+	*mag = _mm256_add_ps(_mm256_mul_ps(*dx, *dx), _mm256_mul_ps(*dy, *dy));
+	*min_dist = _mm256_add_ps(ri, _mm256_loadu_ps(&radius[j]));
+	return _mm256_and_ps(_mm256_cmp_ps(*mag, _mm256_mul_ps(*min_dist, *min_dist), _CMP_LE_OQ), _mm256_cmp_ps(*mag, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+
+/*
+	count_row(), 8 balls at a time.
+*/
+SIMD_TARGET("avx2,popcnt")
+static float count_row_avx2(size_t i, size_t begin, size_t end) {
+	__m256 xi = _mm256_set1_ps(cx[i]), yi = _mm256_set1_ps(cy[i]), ri = _mm256_set1_ps(radius[i]);
+	__m256 dx, dy, mag, min_dist;
+	unsigned int touching = 0;
+
+	size_t j = begin;
+	for (; j + 8 <= end; j += 8) {
+		touching += _mm_popcnt_u32(_mm256_movemask_ps(touching_avx2(xi, yi, ri, j, &dx, &dy, &mag, &min_dist)));
+	}
+	return touching + count_row(i, j, end);
+}
+
+/*
+	collide_row(), 8 balls at a time. Blocks with no collision stop after the distance test.
+*/
+SIMD_TARGET("avx2")
+static void collide_row_avx2(size_t i, size_t begin, size_t end, response& r) {
+	__m256 xi = _mm256_set1_ps(cx[i]), yi = _mm256_set1_ps(cy[i]), ri = _mm256_set1_ps(radius[i]);
+	__m256 vxi = _mm256_set1_ps(vx[i]), vyi = _mm256_set1_ps(vy[i]), mi = _mm256_set1_ps(inv_mass[i]);
+	__m256 ci = _mm256_set1_ps(contacts[i]);
+	__m256 zero = _mm256_setzero_ps(), half = _mm256_set1_ps(0.5f), two = _mm256_set1_ps(2.f);
+	__m256 px = zero, py = zero, pvx = zero, pvy = zero;
+	__m256 dx, dy, mag, min_dist;
+
+	size_t j = begin;
+	for (; j + 8 <= end; j += 8) {
+		__m256 hit = touching_avx2(xi, yi, ri, j, &dx, &dy, &mag, &min_dist);
+		if (!_mm256_movemask_ps(hit)) continue;
+
+		__m256 dist = _mm256_sqrt_ps(mag);
+		__m256 push = _mm256_div_ps(_mm256_mul_ps(half, _mm256_sub_ps(min_dist, dist)), dist);
+		px = _mm256_add_ps(px, _mm256_and_ps(hit, _mm256_mul_ps(push, dx)));
+		py = _mm256_add_ps(py, _mm256_and_ps(hit, _mm256_mul_ps(push, dy)));
+
+		__m256 dvx = _mm256_sub_ps(vxi, _mm256_loadu_ps(&vx[j]));
+		__m256 dvy = _mm256_sub_ps(vyi, _mm256_loadu_ps(&vy[j]));
+		__m256 along = _mm256_add_ps(_mm256_mul_ps(dvx, dx), _mm256_mul_ps(dvy, dy));
+		__m256 masses = _mm256_mul_ps(_mm256_add_ps(mi, _mm256_loadu_ps(&inv_mass[j])), mag);
+		masses = _mm256_mul_ps(masses, _mm256_max_ps(ci, _mm256_loadu_ps(&contacts[j])));
+		__m256 share = _mm256_mul_ps(mi, _mm256_div_ps(_mm256_mul_ps(two, along), masses));
+		pvx = _mm256_sub_ps(pvx, _mm256_and_ps(hit, _mm256_mul_ps(share, dx)));
+		pvy = _mm256_sub_ps(pvy, _mm256_and_ps(hit, _mm256_mul_ps(share, dy)));
+	}
+
+	r.x += horizontal_sum(px);
+	r.y += horizontal_sum(py);
+	r.vx += horizontal_sum(pvx);
+	r.vy += horizontal_sum(pvy);
+	collide_row(i, j, end, r);
+}
+
+// lanes of balls touching ball i (xi, yi, ri broadcast) among the 16 from j.
+SIMD_TARGET("avx512f")
+static __mmask16 touching_avx512(__m512 xi, __m512 yi, __m512 ri, size_t j, __m512* dx, __m512* dy, __m512* mag, __m512* min_dist) {
+	*dx = _mm512_sub_ps(xi, _mm512_loadu_ps(&cx[j]));
+	*dy = _mm512_sub_ps(yi, _mm512_loadu_ps(&cy[j]));
+	*mag = _mm512_add_ps(_mm512_mul_ps(*dx, *dx), _mm512_mul_ps(*dy, *dy));
+	*min_dist = _mm512_add_ps(ri, _mm512_loadu_ps(&radius[j]));
+	return _mm512_cmp_ps_mask(*mag, _mm512_mul_ps(*min_dist, *min_dist), _CMP_LE_OQ)
+		& _mm512_cmp_ps_mask(*mag, _mm512_setzero_ps(), _CMP_GT_OQ);
+}
+
+/*
+	count_row(), 16 balls at a time.
+*/
+SIMD_TARGET("avx512f,popcnt")
+static float count_row_avx512(size_t i, size_t begin, size_t end) {
+	__m512 xi = _mm512_set1_ps(cx[i]), yi = _mm512_set1_ps(cy[i]), ri = _mm512_set1_ps(radius[i]);
+	__m512 dx, dy, mag, min_dist;
+	unsigned int touching = 0;
+
+	size_t j = begin;
+	for (; j + 16 <= end; j += 16) {
+		touching += _mm_popcnt_u32(touching_avx512(xi, yi, ri, j, &dx, &dy, &mag, &min_dist));
+	}
+	return touching + count_row(i, j, end);
+}
+
+/*
+	collide_row(), 16 balls at a time.
+*/
+SIMD_TARGET("avx512f")
+static void collide_row_avx512(size_t i, size_t begin, size_t end, response& r) {
+	__m512 xi = _mm512_set1_ps(cx[i]), yi = _mm512_set1_ps(cy[i]), ri = _mm512_set1_ps(radius[i]);
+	__m512 vxi = _mm512_set1_ps(vx[i]), vyi = _mm512_set1_ps(vy[i]), mi = _mm512_set1_ps(inv_mass[i]);
+	__m512 ci = _mm512_set1_ps(contacts[i]);
+	__m512 zero = _mm512_setzero_ps(), half = _mm512_set1_ps(0.5f), two = _mm512_set1_ps(2.f);
+	__m512 px = zero, py = zero, pvx = zero, pvy = zero;
+	__m512 dx, dy, mag, min_dist;
+
+	size_t j = begin;
+	for (; j + 16 <= end; j += 16) {
+		__mmask16 hit = touching_avx512(xi, yi, ri, j, &dx, &dy, &mag, &min_dist);
+		if (!hit) continue;
+
+		__m512 dist = _mm512_sqrt_ps(mag);
+		__m512 push = _mm512_div_ps(_mm512_mul_ps(half, _mm512_sub_ps(min_dist, dist)), dist);
+		px = _mm512_mask_add_ps(px, hit, px, _mm512_mul_ps(push, dx));
+		py = _mm512_mask_add_ps(py, hit, py, _mm512_mul_ps(push, dy));
+
+		__m512 dvx = _mm512_sub_ps(vxi, _mm512_loadu_ps(&vx[j]));
+		__m512 dvy = _mm512_sub_ps(vyi, _mm512_loadu_ps(&vy[j]));
+		__m512 along = _mm512_add_ps(_mm512_mul_ps(dvx, dx), _mm512_mul_ps(dvy, dy));
+		__m512 masses = _mm512_mul_ps(_mm512_add_ps(mi, _mm512_loadu_ps(&inv_mass[j])), mag);
+		masses = _mm512_mul_ps(masses, _mm512_max_ps(ci, _mm512_loadu_ps(&contacts[j])));
+		__m512 share = _mm512_mul_ps(mi, _mm512_div_ps(_mm512_mul_ps(two, along), masses));
+		pvx = _mm512_mask_sub_ps(pvx, hit, pvx, _mm512_mul_ps(share, dx));
+		pvy = _mm512_mask_sub_ps(pvy, hit, pvy, _mm512_mul_ps(share, dy));
+	}
+
+	r.x += _mm512_reduce_add_ps(px);
+	r.y += _mm512_reduce_add_ps(py);
+	r.vx += _mm512_reduce_add_ps(pvx);
+	r.vy += _mm512_reduce_add_ps(pvy);
+	collide_row(i, j, end, r);
+}
+
+// count_row() with the chosen instruction set.
+static float count_range(size_t i, size_t begin, size_t end) {
+	if (isa == simd::avx512) return count_row_avx512(i, begin, end);
+	if (isa == simd::avx2) return count_row_avx2(i, begin, end);
+	return count_row(i, begin, end);
+}
+
+// collide_row() with the chosen instruction set.
+static void collide_range(size_t i, size_t begin, size_t end, response& r) {
+	if (isa == simd::avx512) collide_row_avx512(i, begin, end, r);
+	else if (isa == simd::avx2) collide_row_avx2(i, begin, end, r);
+	else collide_row(i, begin, end, r);
+}
+
+// returns the uniform grid cell containing position (x, y), as grid_cell() in bouncing_balls.cl.
+static unsigned int grid_cell(float x, float y) {
+	int cell_x = std::min(std::max((int)((x + 1.f) / cell_size), 0), grid_dim - 1);
+	int cell_y = std::min(std::max((int)((y + 1.f) / cell_size), 0), grid_dim - 1);
+	return cell_y * grid_dim + cell_x;
+}
+
+/*
+	Calls visit(begin, end) with the balls ball i may touch: all of them by brute force, or the
+	3x3 cells around its own, whose rows are contiguous once the balls are sorted by cell.
+*/
+template <typename F>
+static void for_neighbours(size_t i, F visit) {
+	if (!grid) {
+		visit((size_t)0, count);
+		return;
+	}
+
+	int cell_x = (int)(cells[i] % grid_dim);
+	int cell_y = (int)(cells[i] / grid_dim);
+	int first_x = std::max(cell_x - 1, 0);
+	int last_x = std::min(cell_x + 1, grid_dim - 1);
+	for (int y = std::max(cell_y - 1, 0); y <= std::min(cell_y + 1, grid_dim - 1); ++y) {
+		size_t begin = cell_starts[y * grid_dim + first_x];
+		size_t end = cell_starts[y * grid_dim + last_x + 1];
+		if (begin < end) visit(begin, end);
+	}
+}
+
+void cpu_create(size_t balls_count, const float* centers, const float* velocities, const float* radii,
+	const float* inv_masses, unsigned int threads, simd instructions, float grid_cell_size) {
+	count = balls_count;
+	isa = instructions;
+
+	cx.resize(count); cy.resize(count); vx.resize(count); vy.resize(count);
+	next_cx.resize(count); next_cy.resize(count); next_vx.resize(count); next_vy.resize(count);
+	next_radius.resize(count); next_inv_mass.resize(count); next_ids.resize(count);
+	contacts.resize(count);
+	radius.assign(radii, radii + count);
+	inv_mass.assign(inv_masses, inv_masses + count);
+	ids.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		cx[i] = centers[2 * i];
+		cy[i] = centers[2 * i + 1];
+		vx[i] = velocities[2 * i];
+		vy[i] = velocities[2 * i + 1];
+		ids[i] = (unsigned int)i;
+	}
+
+	grid = grid_cell_size > 0.f;
+	if (grid) {
+		cell_size = grid_cell_size;
+		grid_dim = (int)ceil(2.f / cell_size);
+		cells.resize(count);
+		next_cells.resize(count);
+		cell_starts.resize(grid_dim * grid_dim + 1);
+		chunk_counts.resize((count + STREAM_GRAIN - 1) / STREAM_GRAIN * grid_dim * grid_dim);
+	}
+
+	pool = new scheduler(threads);
+}
+
+void cpu_destroy() {
+	delete pool;
+	pool = nullptr;
+}
+
+size_t cpu_steals() {
+	return pool ? pool->steals() : 0;
+}
+
+/*
+	Same as wall_bounce: the loop is plain float arithmetic over consecutive balls, left to the
+	compiler to vectorize.
+*/
+void cpu_wall_bounce(float delta_t, float gravity) {
+	pool->parallel_for(count, STREAM_GRAIN, [delta_t, gravity](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			float v_x = vx[i];
+			float v_y = vy[i] + delta_t * gravity;
+			float c_x = cx[i] + delta_t * v_x;
+			float c_y = cy[i] + delta_t * v_y;
+
+			float wall = 1.f - radius[i];
+			if (c_x > wall || c_x < -wall) {
+				c_x = c_x > wall ? wall : -wall;
+				v_x = -v_x;
+			}
+			if (c_y > wall || c_y < -wall) {
+				c_y = c_y > wall ? wall : -wall;
+				v_y = -v_y;
+			}
+
+			cx[i] = c_x;
+			cy[i] = c_y;
+			vx[i] = v_x;
+			vy[i] = v_y;
+		}
+	});
+}
+
+/*
+	Uniform grid: bins every ball into its cell, then reorders every array by cell with a
+	counting sort, so that the balls of a cell (and of a row of cells) are contiguous for the
+	vector loops and the caches.
+
+	The balls are cut into chunks of STREAM_GRAIN, and every chunk counts its own balls per
+	cell. Scanning the counts of a cell over the chunks gives every chunk its place within the
+	cell, and the cell totals give the cell starts: every chunk then scatters its balls from
+	its own cursors, in order, with no two chunks writing the same slot. Only the scan over the
+	cells, a few dozen of them, is serial.
+*/
+void cpu_broad_phase() {
+	if (!grid) return;
+
+	size_t cells_count = cell_starts.size() - 1;
+	size_t chunks = (count + STREAM_GRAIN - 1) / STREAM_GRAIN;
+
+	pool->parallel_for(chunks, 1, [cells_count](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; ++chunk) {
+			unsigned int* counts = &chunk_counts[chunk * cells_count];
+			std::fill(counts, counts + cells_count, 0u);
+			for (size_t i = chunk * STREAM_GRAIN; i < std::min((chunk + 1) * STREAM_GRAIN, count); ++i) {
+				cells[i] = grid_cell(cx[i], cy[i]);
+				++counts[cells[i]];
+			}
+		}
+	});
+
+	// every cell's counts become the chunks' offsets within the cell, and its total its size.
+	pool->parallel_for(cells_count, 1, [cells_count, chunks](size_t begin, size_t end) {
+		for (size_t c = begin; c < end; ++c) {
+			unsigned int total = 0;
+			for (size_t chunk = 0; chunk < chunks; ++chunk) {
+				unsigned int balls = chunk_counts[chunk * cells_count + c];
+				chunk_counts[chunk * cells_count + c] = total;
+				total += balls;
+			}
+			cell_starts[c + 1] = total;
+		}
+	});
+	cell_starts[0] = 0;
+	for (size_t c = 1; c <= cells_count; ++c) cell_starts[c] += cell_starts[c - 1];
+
+	// stable: the balls of a cell keep their order, chunk after chunk.
+	pool->parallel_for(chunks, 1, [cells_count](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; ++chunk) {
+			unsigned int* cursors = &chunk_counts[chunk * cells_count];
+			for (size_t i = chunk * STREAM_GRAIN; i < std::min((chunk + 1) * STREAM_GRAIN, count); ++i) {
+				unsigned int cell = cells[i];
+				unsigned int slot = cell_starts[cell] + cursors[cell]++;
+				next_cx[slot] = cx[i];
+				next_cy[slot] = cy[i];
+				next_vx[slot] = vx[i];
+				next_vy[slot] = vy[i];
+				next_radius[slot] = radius[i];
+				next_inv_mass[slot] = inv_mass[i];
+				next_ids[slot] = ids[i];
+				next_cells[slot] = cell;
+			}
+		}
+	});
+
+	cx.swap(next_cx);
+	cy.swap(next_cy);
+	vx.swap(next_vx);
+	vy.swap(next_vy);
+	radius.swap(next_radius);
+	inv_mass.swap(next_inv_mass);
+	ids.swap(next_ids);
+	cells.swap(next_cells);
+}
+
+/*
+	Every ball counts the balls it touches, then sums its own response to every ball it may
+	touch from the positions and velocities at the start of the pass, and writes the result
+	to the next arrays: no two threads write the same ball.
+
+	The cost of a ball depends on how crowded its neighbourhood is (or is the same for every
+	ball by brute force), so the balls go to the scheduler in small ranges that idle threads
+	can steal. Every pair is seen from both balls, twice, in exchange for having no write
+	conflicts, and momentum is still exchanged pair by pair.
+*/
+void cpu_ball_bounce() {
+	pool->parallel_for(count, PAIR_GRAIN, [](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			float touching = 0.f;
+			for_neighbours(i, [&](size_t first, size_t last) { touching += count_range(i, first, last); });
+			contacts[i] = touching;
+		}
+	});
+
+	pool->parallel_for(count, PAIR_GRAIN, [](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			response r;
+			if (contacts[i] > 0.f) {
+				for_neighbours(i, [&](size_t first, size_t last) { collide_range(i, first, last, r); });
+				r.x /= contacts[i];
+				r.y /= contacts[i];
+			}
+
+			next_cx[i] = cx[i] + r.x;
+			next_cy[i] = cy[i] + r.y;
+			next_vx[i] = vx[i] + r.vx;
+			next_vy[i] = vy[i] + r.vy;
+		}
+	});
+
+	cx.swap(next_cx);
+	cy.swap(next_cy);
+	vx.swap(next_vx);
+	vy.swap(next_vy);
+}
+
+void cpu_update_vbo(float* vbo, const float* circle, const unsigned int* lod_steps, int num_points) {
+	pool->parallel_for(count, STREAM_GRAIN, [=](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			// the host's order, whatever the grid's.
+			float* vertex = vbo + 2 * (size_t)ids[i] * num_points;
+			int step = lod_steps ? (int)lod_steps[ids[i]] : 1;
+
+			if (step >= num_points) {
+				vertex[0] = cx[i];
+				vertex[1] = cy[i];
+				continue;
+			}
+
+			for (int j = 0; j * step < num_points; ++j) {
+				vertex[2 * j] = cx[i] + radius[i] * circle[2 * j * step];
+				vertex[2 * j + 1] = cy[i] + radius[i] * circle[2 * j * step + 1];
+			}
+		}
+	});
+}
+
+void cpu_update_instances(float* instances) {
+	pool->parallel_for(count, STREAM_GRAIN, [=](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			float* instance = instances + 4 * (size_t)ids[i];
+			instance[0] = cx[i];
+			instance[1] = cy[i];
+			instance[2] = radius[i];
+			instance[3] = 0.f;
+		}
+	});
+}
+
+bool cpu_read_balls(float* centers, float* velocities) {
+	if (!pool) return false;
+
+	pool->parallel_for(count, STREAM_GRAIN, [=](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			size_t id = ids[i];
+			centers[2 * id] = cx[i];
+			centers[2 * id + 1] = cy[i];
+			velocities[2 * id] = vx[i];
+			velocities[2 * id + 1] = vy[i];
+		}
+	});
+	return true;
+}
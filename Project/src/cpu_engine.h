@@ -0,0 +1,65 @@
+/*
+	Native host engine, doing the work of wall_bounce, ball_bounce and update_vbo (or
+	update_instances) of bouncing_balls.cl on the CPU, with no OpenCL involved.
+
+	The collisions do not follow ball_bounce step for step: ball_bounce updates both balls of
+	a pair in place, in whatever order the work-items run, while the engine computes every
+	ball's response from the state at the start of the pass (Jacobi, like the gather resolve),
+	averaging the push over the ball's contacts and sharing the exchange between the contacts
+	of the busier ball. An isolated pair bounces the same on both backends, but piles differ,
+	and a CPU run does not reproduce an OpenCL run of the same seed.
+
+	The balls are split into one array per coordinate so that the inner loops run over
+	consecutive floats, with explicit AVX2 or AVX-512 paths chosen at run time. The work is
+	spread over a work-stealing scheduler, the calling thread being one of its threads. With a
+	uniform grid, the balls are kept sorted by cell, so the engine's order differs from the
+	host's: the vertices and instances are written back in the host's order.
+*/
+#ifndef CPU_ENGINE_H
+#define CPU_ENGINE_H
+
+#include <stddef.h>
+
+// instruction set of the engine's inner loops.
+enum class simd {
+	scalar,
+	avx2,
+	avx512
+};
+
+// the widest instruction set supported by both the CPU and the OS.
+simd detect_simd();
+
+// copies the balls in (centers and velocities as x, y pairs) and starts threads workers. A
+// grid_cell_size above 0 (at least the largest diameter) enables the uniform grid, else every
+// pair is tested.
+void cpu_create(size_t balls_count, const float* centers, const float* velocities, const float* radii,
+	const float* inv_masses, unsigned int threads, simd isa, float grid_cell_size);
+
+// joins the workers and frees the balls, if created.
+void cpu_destroy();
+
+// gravity, integration and wall collisions over delta_t, as wall_bounce.
+void cpu_wall_bounce(float delta_t, float gravity);
+
+// sorts the balls into the uniform grid, as build_grid; nothing without a grid.
+void cpu_broad_phase();
+
+// ball-ball collisions, every pair or the 3x3 cells around every ball tested, as ball_bounce.
+void cpu_ball_bounce();
+
+// ranges of work stolen between threads since cpu_create.
+size_t cpu_steals();
+
+// writes the tessellated balls to vbo, as update_vbo: every lod_steps[i]-th vertex of the
+// num_points vertices of the unit circle (x, y pairs), or every vertex if lod_steps is null.
+void cpu_update_vbo(float* vbo, const float* circle, const unsigned int* lod_steps, int num_points);
+
+// writes the center and radius of every ball to instances (4 floats each), as update_instances.
+void cpu_update_instances(float* instances);
+
+// copies the balls out, in the order they came in (centers and velocities as x, y pairs).
+// Returns false, copying nothing, if the engine has no balls.
+bool cpu_read_balls(float* centers, float* velocities);
+
+#endif
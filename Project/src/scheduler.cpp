@@ -0,0 +1,167 @@
+#include "scheduler.h"
+#include <algorithm>
+
+// failed attempts at finding a range before a thread sleeps: ranges split off by the others
+// usually turn up within a few, and sleeping costs a system call on both sides.
+#define IDLE_SPINS 64
+
+scheduler::scheduler(unsigned int threads) {
+	if (threads < 1) threads = 1;
+	for (unsigned int i = 0; i < threads; ++i) deques.emplace_back(new work_deque);
+	// worker i owns deque i, the calling thread owns the first one.
+	for (unsigned int i = 1; i < threads; ++i) workers.emplace_back(&scheduler::work, this, i);
+}
+
+scheduler::~scheduler() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	start.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+/*
+	Seeds every deque with an even share of [0, count), so that balanced work needs no steal,
+	then works alongside the workers until no item is left.
+*/
+void scheduler::parallel_for(size_t count, size_t grain_size, const std::function<void(size_t, size_t)>& parallel_task) {
+	if (count == 0) return;
+	grain = grain_size < 1 ? 1 : grain_size;
+
+	if (workers.empty()) {
+		for (size_t begin = 0; begin < count; begin += grain) parallel_task(begin, std::min(begin + grain, count));
+		return;
+	}
+
+	size_t shares = deques.size();
+	for (size_t i = 0; i < shares; ++i) {
+		size_t begin = count * i / shares;
+		size_t end = count * (i + 1) / shares;
+		if (begin < end) push((unsigned int)i, { begin, end });
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &parallel_task;
+		remaining = count;
+		active = (unsigned int)workers.size();
+		++generation;
+	}
+	start.notify_all();
+
+	run(0);
+
+	// the workers must be out of run() before task goes out of scope.
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return active == 0; });
+	task = nullptr;
+}
+
+size_t scheduler::steals() const {
+	return stolen;
+}
+
+void scheduler::work(unsigned int index) {
+	unsigned long long seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+		}
+
+		run(index);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--active == 0) done.notify_one();
+	}
+}
+
+/*
+	Takes ranges from its own deque, or steals them, until every item of the current
+	parallel_for is done. Ranges above the grain are halved, the upper half going back to
+	the deque where a thief can find it. After IDLE_SPINS attempts finding nothing, the
+	thread sleeps until a range is pushed or the last item is done.
+*/
+void scheduler::run(unsigned int index) {
+	range r;
+	int misses = 0;
+	while (remaining > 0) {
+		// read before looking, so that a range pushed after the look wakes the thread.
+		size_t seen = pushes;
+		if (!pop(index, r) && !steal(index, r)) {
+			if (++misses < IDLE_SPINS) {
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(idle_mutex);
+			++sleeping;
+			idle.wait(lock, [&] { return remaining == 0 || pushes != seen; });
+			--sleeping;
+			misses = 0;
+			continue;
+		}
+		misses = 0;
+
+		while (r.end - r.begin > grain) {
+			size_t middle = r.begin + (r.end - r.begin) / 2;
+			push(index, { middle, r.end });
+			r.end = middle;
+		}
+
+		(*task)(r.begin, r.end);
+		if ((remaining -= r.end - r.begin) == 0) wake_idle();
+	}
+}
+
+/*
+	Wakes the sleeping threads, if any. Counting the sleepers and changing what they wait on
+	are both sequentially consistent, so either the waker sees a sleeper or the sleeper sees
+	the change before it sleeps.
+*/
+void scheduler::wake_idle() {
+	if (sleeping == 0) return;
+	std::lock_guard<std::mutex> lock(idle_mutex);
+	idle.notify_all();
+}
+
+void scheduler::push(unsigned int index, range r) {
+	{
+		work_deque& deque = *deques[index];
+		std::lock_guard<std::mutex> lock(deque.mutex);
+		deque.ranges.push_back(r);
+	}
+	++pushes;
+	wake_idle();
+}
+
+bool scheduler::pop(unsigned int index, range& r) {
+	work_deque& deque = *deques[index];
+	std::lock_guard<std::mutex> lock(deque.mutex);
+	if (deque.ranges.empty()) return false;
+	r = deque.ranges.back();
+	deque.ranges.pop_back();
+	return true;
+}
+
+/*
+	Takes the oldest range of the first other deque that has one, starting from the next
+	thread so that thieves spread over their victims.
+*/
+bool scheduler::steal(unsigned int index, range& r) {
+	size_t count = deques.size();
+	for (size_t offset = 1; offset < count; ++offset) {
+		work_deque& deque = *deques[(index + offset) % count];
+		std::lock_guard<std::mutex> lock(deque.mutex);
+		if (deque.ranges.empty()) continue;
+
+		r = deque.ranges.front();
+		deque.ranges.pop_front();
+		++stolen;
+		return true;
+	}
+	return false;
+}
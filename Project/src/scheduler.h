@@ -0,0 +1,73 @@
+/*
+	Work-stealing scheduler of the CPU engine.
+
+	Every thread owns a deque of ranges of work. A thread takes ranges from the back of its own
+	deque, halving them down to the grain and leaving the upper halves behind, and once its
+	deque is empty it steals the oldest (largest) range from the front of another one. Uneven
+	work, such as crowded grid cells, thus spreads over the threads instead of waiting on the
+	slowest static share. A thread that finds nothing to steal for a while sleeps until a range
+	is pushed or the work is done, leaving its core to the threads still working.
+*/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+class scheduler {
+public:
+	// starts threads - 1 workers, the thread calling parallel_for being the last one.
+	explicit scheduler(unsigned int threads);
+	~scheduler();
+
+	// runs task(begin, end) over [0, count) in ranges of at most grain items, and returns once
+	// every item is done.
+	void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& task);
+
+	// ranges taken from another thread's deque since the scheduler started.
+	size_t steals() const;
+
+private:
+	struct range {
+		size_t begin, end;
+	};
+
+	// a thread's ranges: the owner pushes and pops at the back, thieves take from the front.
+	struct work_deque {
+		std::mutex mutex;
+		std::deque<range> ranges;
+	};
+
+	void work(unsigned int index);
+	void run(unsigned int index);
+	void wake_idle();
+	void push(unsigned int index, range r);
+	bool pop(unsigned int index, range& r);
+	bool steal(unsigned int index, range& r);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<work_deque>> deques;
+	std::mutex mutex;
+	std::condition_variable start, done;
+	const std::function<void(size_t, size_t)>* task = nullptr;
+	size_t grain = 1;
+	std::atomic<size_t> remaining{ 0 };
+	std::atomic<size_t> stolen{ 0 };
+	// threads sleeping in run() for lack of work, and ranges pushed so far, which wakes them.
+	std::mutex idle_mutex;
+	std::condition_variable idle;
+	std::atomic<unsigned int> sleeping{ 0 };
+	std::atomic<size_t> pushes{ 0 };
+	unsigned long long generation = 0;
+	unsigned int active = 0;
+	bool stopping = false;
+};
+
+#endif